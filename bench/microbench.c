@@ -0,0 +1,501 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+// microbenchmarks for the parser, varints, bigdec conversion, request building, stringify and the reader. results are
+//  printed as JSON so that runs can be compared between commits and bigint libraries
+//
+// usage: opacmicrobench [-t millisPerBench] [filter]
+//   filter: only run benchmarks whose name contains this string
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opabigdec.h"
+#include "opac.h"
+#include "opacore.h"
+#include "opapp.h"
+#include "oparb.h"
+#include "opaso.h"
+#include "opasoreader.h"
+
+#define BENCH_TRIALS 3
+
+typedef struct {
+	const char* name;
+	// run the benchmark iters times; return a value that depends on the work so that it is not optimized away
+	uint64_t (*run)(void* ctx, uint64_t iters);
+	void* ctx;
+	size_t bytesPerOp; // 0 if throughput is not meaningful
+} bench;
+
+typedef struct {
+	uint8_t* data; // null terminated (parser requirement)
+	size_t len;
+	const opappOptions* opt;
+} benchPayload;
+
+static uint64_t benchMinNanos = 200 * 1000000ULL;
+static volatile uint64_t benchSink;
+static int benchFirstResult = 1;
+
+
+static void benchDie(const char* msg) {
+	opa_fprintf(stderr, "%s\n", msg);
+	exit(1);
+}
+
+// run 1 benchmark and print its result as a JSON object
+static void benchRun(const bench* b) {
+	// find an iteration count that takes at least benchMinNanos; then keep the best of several trials
+	uint64_t iters = 1;
+	uint64_t elapsed;
+	while (1) {
+		uint64_t start = opaTimeNanos();
+		benchSink += b->run(b->ctx, iters);
+		elapsed = opaTimeNanos() - start;
+		if (elapsed >= benchMinNanos / 4 || iters >= (UINT64_MAX / 4)) {
+			break;
+		}
+		iters = elapsed == 0 ? iters * 16 : iters * 2;
+	}
+	iters = elapsed == 0 ? iters : (uint64_t) ((double) iters * ((double) benchMinNanos / BENCH_TRIALS) / (double) elapsed) + 1;
+	double best = 0;
+	for (int i = 0; i < BENCH_TRIALS; ++i) {
+		uint64_t start = opaTimeNanos();
+		benchSink += b->run(b->ctx, iters);
+		double nsPerOp = (double) (opaTimeNanos() - start) / (double) iters;
+		if (i == 0 || nsPerOp < best) {
+			best = nsPerOp;
+		}
+	}
+	opa_printf("%s\n    {\"name\": \"%s\", \"iters\": %llu, \"ns_per_op\": %.3f", benchFirstResult ? "" : ",", b->name, (unsigned long long) iters, best);
+	if (b->bytesPerOp > 0 && best > 0) {
+		opa_printf(", \"bytes_per_op\": %" OPA_FMT_ZU ", \"gb_per_s\": %.3f", b->bytesPerOp, (double) b->bytesPerOp / best);
+	}
+	opa_printf("}");
+	benchFirstResult = 0;
+}
+
+
+static uint64_t benchFindEnd(void* ctx, uint64_t iters) {
+	const benchPayload* p = ctx;
+	uint64_t numValues = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		opapp pp;
+		memset(&pp, 0, sizeof(pp));
+		const uint8_t* pos = p->data;
+		const uint8_t* stop = p->data + p->len;
+		while (pos < stop) {
+			const uint8_t* end;
+			if (opappFindEnd(&pp, pos, stop - pos, &end, p->opt) || end == NULL) {
+				benchDie("parse error");
+			}
+			pos = end;
+			++numValues;
+		}
+	}
+	return numValues;
+}
+
+static void benchPayloadFinish(benchPayload* p, oparb* rb) {
+	if (rb->err) {
+		benchDie("oparb error");
+	}
+	// note: appending and removing a byte leaves a null char after the data
+	opabuffAppend1(&rb->buff, 0);
+	p->len = opabuffGetLen(&rb->buff) - 1;
+	p->data = opabuffGetPos(&rb->buff, 0);
+	p->opt = NULL;
+}
+
+// many tiny top level values (like a stream of small responses)
+static void benchMakeTiny(benchPayload* p) {
+	oparb rb;
+	oparbInit(&rb, NULL, 0);
+	opabuffSetLen(&rb.buff, 0);
+	for (unsigned int i = 0; i < 20000; ++i) {
+		switch (i % 5) {
+			case 0: oparbAddU64(&rb, i % 100); break;
+			case 1: oparbAddI64(&rb, -((int64_t) i)); break;
+			case 2: oparbAddStr(&rb, 3, "abc"); break;
+			case 3: oparbAddU64(&rb, ((uint64_t) i) << 40); break;
+			default: oparbAddBin(&rb, 0, NULL); break;
+		}
+	}
+	benchPayloadFinish(p, &rb);
+}
+
+// arrays nested 100 deep with small values at each level
+static void benchMakeDeep(benchPayload* p) {
+	oparb rb;
+	oparbInit(&rb, NULL, 0);
+	opabuffSetLen(&rb.buff, 0);
+	for (unsigned int r = 0; r < 200; ++r) {
+		for (unsigned int d = 0; d < 100; ++d) {
+			oparbStartArray(&rb);
+			oparbAddU64(&rb, d);
+		}
+		for (unsigned int d = 0; d < 100; ++d) {
+			oparbStopArray(&rb);
+		}
+	}
+	benchPayloadFinish(p, &rb);
+}
+
+// 1 large string; mostly ascii with some multi-byte utf-8 sequences
+static void benchMakeBigStr(benchPayload* p) {
+	static const char* chunks[] = {"the quick brown fox jumps over the lazy dog. ", "\xC3\xA9t\xC3\xA9 ", "\xE2\x82\xAC 10 ", "\xF0\x9F\x98\x80 "};
+	opabuff s;
+	opabuffInit(&s, 0);
+	for (unsigned int i = 0; opabuffGetLen(&s) < 1024 * 1024; ++i) {
+		const char* c = chunks[i % 7 == 6 ? 1 + (i / 7) % 3 : 0];
+		opabuffAppend(&s, c, strlen(c));
+	}
+	oparb rb;
+	oparbInit(&rb, NULL, 0);
+	opabuffSetLen(&rb.buff, 0);
+	oparbAddStr(&rb, opabuffGetLen(&s), opabuffGetPos(&s, 0));
+	opabuffFree(&s);
+	benchPayloadFinish(p, &rb);
+}
+
+// an array of many big decimals
+static void benchMakeBigDecs(benchPayload* p) {
+	oparb rb;
+	oparbInit(&rb, NULL, 0);
+	opabuffSetLen(&rb.buff, 0);
+	oparbStartArray(&rb);
+	for (unsigned int i = 0; i < 5000; ++i) {
+		char num[64];
+		opa_snprintf(num, sizeof(num), "%u12345678901234567890123.%ue%d", i, i * 7, (int) (i % 50) - 25);
+		oparbAddNumStr(&rb, num, num + strlen(num));
+	}
+	oparbStopArray(&rb);
+	benchPayloadFinish(p, &rb);
+}
+
+
+#define BENCH_NUMVARINTS 4096
+#define BENCH_NUMINTS 100000
+
+typedef struct {
+	uint64_t vals[BENCH_NUMVARINTS];
+	uint8_t buff[BENCH_NUMVARINTS * OPAVI_MAXLEN64];
+	size_t len;
+} benchVarints;
+
+static void benchMakeVarints(benchVarints* v) {
+	uint64_t x = 88172645463325252ULL;
+	uint8_t* pos = v->buff;
+	for (size_t i = 0; i < BENCH_NUMVARINTS; ++i) {
+		// xorshift; then pick a random length so that all encoded lengths are used
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		unsigned int bits = (unsigned int) (x % 64) + 1;
+		v->vals[i] = bits == 64 ? x : x & ((((uint64_t) 1) << bits) - 1);
+		pos = opaviStore(v->vals[i], pos);
+	}
+	v->len = pos - v->buff;
+}
+
+static uint64_t benchVarintLoad(void* ctx, uint64_t iters) {
+	const benchVarints* v = ctx;
+	uint64_t sum = 0;
+	const uint8_t* pos = v->buff;
+	const uint8_t* stop = v->buff + v->len;
+	for (uint64_t i = 0; i < iters; ++i) {
+		if (pos >= stop) {
+			pos = v->buff;
+		}
+		sum += opaviLoad(pos, &pos);
+	}
+	return sum;
+}
+
+static uint64_t benchVarintStore(void* ctx, uint64_t iters) {
+	const benchVarints* v = ctx;
+	uint8_t buff[OPAVI_MAXLEN64];
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		sum += opaviStore(v->vals[i % BENCH_NUMVARINTS], buff) - buff;
+	}
+	return sum;
+}
+
+
+static const char* BENCH_DECSTRS[] = {
+	"1234567890123456789012345678901234567890",
+	"-98765432109876543210.0123456789",
+	"3.14159265358979323846264338327950288e-40",
+	"42"
+};
+
+static uint64_t benchBigDecFromStr(void* ctx, uint64_t iters) {
+	UNUSED(ctx);
+	opabigdec bd;
+	opabigdecInit(&bd);
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		const char* s = BENCH_DECSTRS[i % 4];
+		if (opabigdecFromStr(&bd, s, s + strlen(s), 10)) {
+			benchDie("opabigdecFromStr error");
+		}
+		sum += (uint64_t) bd.exponent;
+	}
+	opabigdecFree(&bd);
+	return sum;
+}
+
+static uint64_t benchBigDecToStr(void* ctx, uint64_t iters) {
+	UNUSED(ctx);
+	opabigdec bds[4];
+	for (size_t i = 0; i < 4; ++i) {
+		opabigdecInit(&bds[i]);
+		if (opabigdecFromStr(&bds[i], BENCH_DECSTRS[i], BENCH_DECSTRS[i] + strlen(BENCH_DECSTRS[i]), 10)) {
+			benchDie("opabigdecFromStr error");
+		}
+	}
+	char str[128];
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		size_t written;
+		if (opabigdecToString(&bds[i % 4], str, sizeof(str), &written, 10)) {
+			benchDie("opabigdecToString error");
+		}
+		sum += written;
+	}
+	for (size_t i = 0; i < 4; ++i) {
+		opabigdecFree(&bds[i]);
+	}
+	return sum;
+}
+
+// build a typical request with a few arguments
+static uint64_t benchOparb(void* ctx, uint64_t iters) {
+	UNUSED(ctx);
+	static const uint8_t asyncId[] = {OPADEF_POSVARINT, 0x81, 0x01};
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		oparb rb;
+		oparbInit(&rb, asyncId, sizeof(asyncId));
+		oparbAddStr(&rb, 4, "HSET");
+		oparbAddStr(&rb, 11, "user:123456");
+		oparbAddStr(&rb, 5, "email");
+		oparbAddStr(&rb, 17, "someone@localhost");
+		oparbAddI64(&rb, -12345);
+		oparbAddU64(&rb, i);
+		oparbAddNumStr(&rb, "123.456", NULL);
+		oparbFinish(&rb);
+		if (rb.err) {
+			benchDie("oparb error");
+		}
+		sum += opabuffGetLen(&rb.buff);
+		opabuffFree(&rb.buff);
+	}
+	return sum;
+}
+
+static uint64_t benchStringify(void* ctx, uint64_t iters) {
+	const benchPayload* p = ctx;
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		char* s = opasoStringify(p->data, NULL);
+		if (s == NULL) {
+			benchDie("opasoStringify error");
+		}
+		sum += (uint64_t) s[0];
+		OPAFREE(s);
+	}
+	return sum;
+}
+
+// a response-like array of mixed values
+static void benchMakeMixed(benchPayload* p) {
+	oparb rb;
+	oparbInit(&rb, NULL, 0);
+	opabuffSetLen(&rb.buff, 0);
+	oparbStartArray(&rb);
+	for (unsigned int i = 0; i < 100; ++i) {
+		oparbAddStr(&rb, 8, "field123");
+		oparbAddU64(&rb, i * 1000003ULL);
+		oparbAddNumStr(&rb, "-0.000123", NULL);
+		oparbAddBin(&rb, 4, "\x01\x02\x03\x04");
+	}
+	oparbStopArray(&rb);
+	benchPayloadFinish(p, &rb);
+}
+
+// decode the mixed array with the reader (no allocations)
+static uint64_t benchSoReader(void* ctx, uint64_t iters) {
+	const benchPayload* p = ctx;
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		opasoReader r;
+		opasoReaderInit(&r, p->data, p->len);
+		int err = opasoReaderEnterArray(&r);
+		while (!err && opasoReaderHasNext(&r)) {
+			const uint8_t* s;
+			size_t slen;
+			uint64_t u;
+			double d;
+			err = opasoReaderReadStr(&r, &s, &slen);
+			if (!err) {
+				err = opasoReaderReadUint64(&r, &u);
+			}
+			if (!err) {
+				err = opasoReaderReadDouble(&r, &d);
+			}
+			if (!err) {
+				err = opasoReaderReadBin(&r, &s, &slen);
+			}
+			sum += u + slen + (d < 0 ? 1 : 0);
+		}
+		if (err) {
+			benchDie("opasoReader error");
+		}
+	}
+	return sum;
+}
+
+// decode the mixed array the way callers did without the reader: walk with opasolen and load numbers as bigdecs
+static uint64_t benchLoadSO(void* ctx, uint64_t iters) {
+	const benchPayload* p = ctx;
+	opabigdec bd;
+	opabigdecInit(&bd);
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		for (const uint8_t* pos = p->data + 1; *pos != OPADEF_ARRAY_END; pos += opasolen(pos)) {
+			const uint8_t* s;
+			size_t slen;
+			if (opasoIsNumber(*pos)) {
+				if (opabigdecLoadSO(&bd, pos)) {
+					benchDie("opabigdecLoadSO error");
+				}
+				sum += (uint64_t) bd.exponent;
+			} else if (opasoGetStrOrBin(pos, &s, &slen) == 0) {
+				sum += slen;
+			}
+		}
+	}
+	opabigdecFree(&bd);
+	return sum;
+}
+
+// a numeric series: mostly small integers (1 byte varints) with some larger values
+static void benchMakeInts(benchPayload* p) {
+	oparb rb;
+	oparbInit(&rb, NULL, 0);
+	opabuffSetLen(&rb.buff, 0);
+	oparbStartArray(&rb);
+	for (unsigned int i = 0; i < BENCH_NUMINTS; ++i) {
+		oparbAddI64(&rb, i % 16 == 0 ? (int64_t) i * 100003 : (int64_t) (i % 200) - 100);
+	}
+	oparbStopArray(&rb);
+	benchPayloadFinish(p, &rb);
+}
+
+static uint64_t benchDecodeI64Array(void* ctx, uint64_t iters) {
+	const benchPayload* p = ctx;
+	static int64_t vals[BENCH_NUMINTS];
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		opasoReader r;
+		size_t count;
+		opasoReaderInit(&r, p->data, p->len);
+		if (opasoReaderEnterArray(&r) || opasoReaderDecodeI64Array(&r, vals, BENCH_NUMINTS, NULL, &count) || count != BENCH_NUMINTS) {
+			benchDie("opasoReaderDecodeI64Array error");
+		}
+		sum += (uint64_t) vals[i % BENCH_NUMINTS];
+	}
+	return sum;
+}
+
+// same as benchDecodeI64Array() but 1 element at a time
+static uint64_t benchReadInt64Loop(void* ctx, uint64_t iters) {
+	const benchPayload* p = ctx;
+	static int64_t vals[BENCH_NUMINTS];
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		opasoReader r;
+		opasoReaderInit(&r, p->data, p->len);
+		int err = opasoReaderEnterArray(&r);
+		for (size_t j = 0; j < BENCH_NUMINTS && !err; ++j) {
+			err = opasoReaderReadInt64(&r, &vals[j]);
+		}
+		if (err) {
+			benchDie("opasoReaderReadInt64 error");
+		}
+		sum += (uint64_t) vals[i % BENCH_NUMINTS];
+	}
+	return sum;
+}
+
+
+int main(int argc, char** argv) {
+	const char* filter = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			benchMinNanos = strtoull(argv[++i], NULL, 10) * 1000000ULL;
+		} else if (argv[i][0] == '-') {
+			benchDie("usage: opacmicrobench [-t millisPerBench] [filter]");
+		} else {
+			filter = argv[i];
+		}
+	}
+
+	static const opappOptions noUtf8 = {UINT_MAX, 0, SIZE_MAX, INT32_MAX};
+	benchPayload tiny, deep, bigStr, bigDecs, mixed, ints;
+	benchMakeTiny(&tiny);
+	benchMakeDeep(&deep);
+	benchMakeBigStr(&bigStr);
+	benchMakeBigDecs(&bigDecs);
+	benchMakeMixed(&mixed);
+	benchMakeInts(&ints);
+	benchPayload tinyNoUtf8 = tiny;
+	benchPayload bigStrNoUtf8 = bigStr;
+	tinyNoUtf8.opt = &noUtf8;
+	bigStrNoUtf8.opt = &noUtf8;
+	static benchVarints varints;
+	benchMakeVarints(&varints);
+
+	const bench benches[] = {
+		{"findend_tiny_utf8",     benchFindEnd,       &tiny,         tiny.len},
+		{"findend_tiny",          benchFindEnd,       &tinyNoUtf8,   tinyNoUtf8.len},
+		{"findend_deep",          benchFindEnd,       &deep,         deep.len},
+		{"findend_bigstr_utf8",   benchFindEnd,       &bigStr,       bigStr.len},
+		// without utf-8 checking the string is skipped by its length prefix so throughput is not meaningful
+		{"findend_bigstr",        benchFindEnd,       &bigStrNoUtf8, 0},
+		{"findend_bigdecs",       benchFindEnd,       &bigDecs,      bigDecs.len},
+		{"varint_load",           benchVarintLoad,    &varints,      0},
+		{"varint_store",          benchVarintStore,   &varints,      0},
+		{"bigdec_fromstr",        benchBigDecFromStr, NULL,          0},
+		{"bigdec_tostr",          benchBigDecToStr,   NULL,          0},
+		{"oparb_request",         benchOparb,         NULL,          0},
+		{"stringify_mixed",       benchStringify,     &mixed,        mixed.len},
+		{"soreader_mixed",        benchSoReader,      &mixed,        mixed.len},
+		{"loadso_mixed",          benchLoadSO,        &mixed,        mixed.len},
+		{"decode_i64_array",      benchDecodeI64Array, &ints,        ints.len},
+		{"readint64_loop",        benchReadInt64Loop, &ints,         ints.len}
+	};
+
+	const opacBuildInfo* info = opacGetBuildInfo();
+	opa_printf("{\n  \"version\": \"%s\",\n  \"bigint\": \"%s\",\n  \"results\": [", info->version, info->bigIntLib);
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+		if (filter == NULL || strstr(benches[i].name, filter) != NULL) {
+			benchRun(&benches[i]);
+		}
+	}
+	opa_printf("\n  ]\n}\n");
+
+	OPAFREE(tiny.data);
+	OPAFREE(deep.data);
+	OPAFREE(bigStr.data);
+	OPAFREE(bigDecs.data);
+	OPAFREE(mixed.data);
+	OPAFREE(ints.data);
+	return benchSink == 0x12345 ? 1 : 0;
+}
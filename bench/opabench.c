@@ -0,0 +1,742 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+// load generator (similar to redis-benchmark). drives many opac clients with the epoll reactor against a
+//  bundled mock server (or an external server) and reports throughput and latency percentiles. the mock
+//  server runs in the same process and responds to each request with its first argument (or null)
+//
+// usage: opabench [options]
+//   -c clients    number of client connections (default 50)
+//   -n requests   total number of requests (default 100000)
+//   -P pipeline   number of requests that each client keeps in flight (default 1)
+//   -d size       number of bytes in the bin argument of each request (default 3)
+//   -t threads    number of client threads; each has its own reactor (default 1)
+//   -T threads    number of mock server threads (default 1)
+//   -a            use async ids rather than sync (null) ids
+//   -m mode       transport: pair (socketpair), tcp, or unix (default pair)
+//   -h host       host for tcp (default 127.0.0.1)
+//   -p port       port for tcp (default: any free port for the mock server; 4567 with -e)
+//   -s path       path of unix socket (default /tmp/opabench.<pid>.sock)
+//   -e            send requests to an external server rather than starting the mock server (tcp or unix)
+//   -r command    command name to send (default ECHO)
+//   -j            print results as JSON
+
+#define _GNU_SOURCE // accept4 SOCK_NONBLOCK SOCK_CLOEXEC EPOLLEXCLUSIVE MSG_NOSIGNAL
+
+#ifndef __linux__
+#error "opabench requires linux (epoll)"
+#endif
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "opacore.h"
+#include "opacreactor.h"
+#include "opahist.h"
+#include "oparb.h"
+#include "opaso.h"
+
+#define MOCK_READLEN (1024 * 64)
+#define MOCK_MAXEVENTS 64
+
+typedef struct mockConn_s mockConn;
+
+struct mockConn_s {
+	int fd;
+	opapp pp;
+	opabuff in;    // bytes of requests that have not been responded to yet
+	size_t parsed; // number of bytes in "in" that were passed to the parser
+	opabuff out;   // responses that have not been written yet
+	size_t outPos;
+	mockConn* next;
+	mockConn* prev;
+};
+
+typedef struct {
+	pthread_t thread;
+	int epfd;
+	mockConn* conns;
+} mockThread;
+
+typedef struct benchClient_s benchClient;
+typedef struct benchThread_s benchThread;
+
+typedef struct {
+	opacReqAsync ar;
+	benchClient* cl;
+	uint64_t start;
+} benchReq;
+
+struct benchClient_s {
+	opacreactorConn conn;
+	benchThread* t;
+	benchReq* reqs;
+	int fd;          // client end of the socketpair (pair mode)
+	uint64_t quota;  // number of requests that this client sends
+	uint64_t issued;
+	uint64_t done;
+};
+
+struct benchThread_s {
+	pthread_t thread;
+	opacreactor r;
+	benchClient* clients;
+	size_t numClients;
+	size_t active;   // clients that have not received all of their responses
+	int failed;
+	uint64_t start;
+	uint64_t end;
+	uint64_t errors;
+	opahist hist;
+};
+
+static struct {
+	size_t clients;
+	uint64_t requests;
+	size_t pipeline;
+	size_t payloadLen;
+	size_t threads;
+	size_t serverThreads;
+	int async;
+	const char* mode;
+	const char* host;
+	const char* port;
+	const char* path;
+	int external;
+	const char* cmd;
+	int json;
+	uint8_t* payload;
+} cfg = {50, 100000, 1, 3, 1, 1, 0, "pair", "127.0.0.1", NULL, NULL, 0, "ECHO", 0, NULL};
+
+static mockThread* mockThreads;
+static int mockListenFd = -1;
+static int mockStopFd = -1;
+
+
+static void benchDie(const char* msg) {
+	opa_fprintf(stderr, "%s\n", msg);
+	exit(1);
+}
+
+static void benchDieErrno(const char* msg) {
+	opa_fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}
+
+
+static void mockClose(mockThread* mt, mockConn* conn) {
+	epoll_ctl(mt->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	if (conn->prev != NULL) {
+		conn->prev->next = conn->next;
+	} else {
+		mt->conns = conn->next;
+	}
+	if (conn->next != NULL) {
+		conn->next->prev = conn->prev;
+	}
+	opabuffFree(&conn->in);
+	opabuffFree(&conn->out);
+	OPAFREE(conn);
+}
+
+static void mockAdd(mockThread* mt, int fd) {
+	mockConn* conn = OPAMALLOC(sizeof(mockConn));
+	if (conn == NULL) {
+		benchDie("out of memory");
+	}
+	memset(conn, 0, sizeof(mockConn));
+	conn->fd = fd;
+	opabuffInit(&conn->in, 0);
+	opabuffInit(&conn->out, 0);
+	conn->next = mt->conns;
+	if (conn->next != NULL) {
+		conn->next->prev = conn;
+	}
+	mt->conns = conn;
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = conn;
+	if (epoll_ctl(mt->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		benchDieErrno("epoll_ctl");
+	}
+}
+
+// append the response to 1 request: [asyncid firstArg]. no response is sent if asyncid is false
+static int mockRespond(mockConn* conn, const uint8_t* req) {
+	if (*req != OPADEF_ARRAY_START || req[1] == OPADEF_ARRAY_END) {
+		return OPA_ERR_PARSE;
+	}
+	const uint8_t* id = req + 1;
+	size_t idLen = opasolen(id);
+	const uint8_t* cmd = id + idLen;
+	const uint8_t* arg = *cmd == OPADEF_ARRAY_END ? cmd : cmd + opasolen(cmd);
+	if (*id == OPADEF_FALSE) {
+		return 0;
+	}
+	int err = opabuffAppend1(&conn->out, OPADEF_ARRAY_START);
+	err = err ? err : opabuffAppend(&conn->out, id, idLen);
+	if (*arg == OPADEF_ARRAY_END) {
+		err = err ? err : opabuffAppend1(&conn->out, OPADEF_NULL);
+	} else {
+		err = err ? err : opabuffAppend(&conn->out, arg, opasolen(arg));
+	}
+	return err ? err : opabuffAppend1(&conn->out, OPADEF_ARRAY_END);
+}
+
+// parse the requests that were read and queue their responses
+static int mockParse(mockConn* conn) {
+	size_t len = opabuffGetLen(&conn->in);
+	// note: parser requires a null char after the bytes
+	if (opabuffAppend1(&conn->in, 0)) {
+		return OPA_ERR_NOMEM;
+	}
+	opabuffSetLen(&conn->in, len);
+	uint8_t* data = opabuffGetPos(&conn->in, 0);
+	size_t start = 0;
+	while (conn->parsed < len) {
+		const uint8_t* end;
+		int err = opappFindEnd(&conn->pp, data + conn->parsed, len - conn->parsed, &end, NULL);
+		if (err) {
+			return err;
+		}
+		if (end == NULL) {
+			conn->parsed = len;
+			break;
+		}
+		err = mockRespond(conn, data + start);
+		if (err) {
+			return err;
+		}
+		start = end - data;
+		conn->parsed = start;
+		memset(&conn->pp, 0, sizeof(opapp));
+	}
+	if (start > 0) {
+		memmove(data, data + start, len - start);
+		opabuffSetLen(&conn->in, len - start);
+		conn->parsed -= start;
+	}
+	return 0;
+}
+
+// return 0 if the connection is still open
+static int mockRead(mockConn* conn) {
+	while (1) {
+		size_t len = opabuffGetLen(&conn->in);
+		if (opabuffSetLen(&conn->in, len + MOCK_READLEN)) {
+			return OPA_ERR_NOMEM;
+		}
+		ssize_t n = read(conn->fd, opabuffGetPos(&conn->in, len), MOCK_READLEN);
+		opabuffSetLen(&conn->in, n > 0 ? len + n : len);
+		if (n > 0) {
+			continue;
+		} else if (n == 0) {
+			return OPA_ERR_EOF;
+		} else if (errno == EINTR) {
+			continue;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return mockParse(conn);
+		}
+		return OPA_ERR_INTERNAL;
+	}
+}
+
+static int mockFlush(mockConn* conn) {
+	size_t len = opabuffGetLen(&conn->out);
+	while (conn->outPos < len) {
+		ssize_t n = send(conn->fd, opabuffGetPos(&conn->out, conn->outPos), len - conn->outPos, MSG_NOSIGNAL);
+		if (n > 0) {
+			conn->outPos += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		} else {
+			return OPA_ERR_INTERNAL;
+		}
+	}
+	opabuffSetLen(&conn->out, 0);
+	conn->outPos = 0;
+	return 0;
+}
+
+static void mockAccept(mockThread* mt) {
+	while (1) {
+		int fd = accept4(mockListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd >= 0) {
+			mockAdd(mt, fd);
+		} else if (errno != EINTR) {
+			// EAGAIN: another thread accepted the connection
+			break;
+		}
+	}
+}
+
+static void* mockRun(void* arg) {
+	mockThread* mt = arg;
+	struct epoll_event events[MOCK_MAXEVENTS];
+	while (1) {
+		int n = epoll_wait(mt->epfd, events, MOCK_MAXEVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			benchDieErrno("epoll_wait");
+		}
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.ptr == &mockStopFd) {
+				while (mt->conns != NULL) {
+					mockClose(mt, mt->conns);
+				}
+				return NULL;
+			} else if (events[i].data.ptr == &mockListenFd) {
+				mockAccept(mt);
+				continue;
+			}
+			mockConn* conn = events[i].data.ptr;
+			int err = 0;
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				err = mockRead(conn);
+			}
+			if (!err) {
+				err = mockFlush(conn);
+			}
+			if (err) {
+				if (err != OPA_ERR_EOF) {
+					opa_fprintf(stderr, "mock server closed connection (err %d)\n", err);
+				}
+				mockClose(mt, conn);
+			}
+		}
+	}
+}
+
+static void mockEpollAdd(mockThread* mt, int fd, void* ptr, uint32_t events) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+	if (epoll_ctl(mt->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		benchDieErrno("epoll_ctl");
+	}
+}
+
+// create the mock server's threads; each has its own epoll instance. connections accepted from the listening
+//  socket (tcp/unix) belong to the thread that accepted them
+static void mockStart(benchClient* clients) {
+	char portStr[16];
+	if (strcmp(cfg.mode, "tcp") == 0) {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons((uint16_t) (cfg.port == NULL ? 0 : atoi(cfg.port)));
+		mockListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		int one = 1;
+		setsockopt(mockListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		socklen_t addrLen = sizeof(addr);
+		if (mockListenFd < 0 || bind(mockListenFd, (struct sockaddr*) &addr, sizeof(addr)) || getsockname(mockListenFd, (struct sockaddr*) &addr, &addrLen)) {
+			benchDieErrno("mock server bind");
+		}
+		opa_snprintf(portStr, sizeof(portStr), "%u", (unsigned int) ntohs(addr.sin_port));
+		cfg.host = "127.0.0.1";
+		cfg.port = portStr;
+	} else if (strcmp(cfg.mode, "unix") == 0) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(cfg.path) >= sizeof(addr.sun_path)) {
+			benchDie("unix socket path is too long");
+		}
+		strcpy(addr.sun_path, cfg.path);
+		unlink(cfg.path);
+		mockListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (mockListenFd < 0 || bind(mockListenFd, (struct sockaddr*) &addr, sizeof(addr))) {
+			benchDieErrno("mock server bind");
+		}
+	}
+	if (mockListenFd >= 0 && listen(mockListenFd, 1024)) {
+		benchDieErrno("listen");
+	}
+	mockStopFd = eventfd(0, EFD_CLOEXEC);
+	if (mockStopFd < 0) {
+		benchDieErrno("eventfd");
+	}
+
+	mockThreads = OPACALLOC(cfg.serverThreads, sizeof(mockThread));
+	if (mockThreads == NULL) {
+		benchDie("out of memory");
+	}
+	for (size_t i = 0; i < cfg.serverThreads; ++i) {
+		mockThread* mt = &mockThreads[i];
+		mt->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (mt->epfd < 0) {
+			benchDieErrno("epoll_create1");
+		}
+		// note: stop event is level triggered and is never read so that every thread sees it
+		mockEpollAdd(mt, mockStopFd, &mockStopFd, EPOLLIN);
+		if (mockListenFd >= 0) {
+			mockEpollAdd(mt, mockListenFd, &mockListenFd, EPOLLIN | EPOLLEXCLUSIVE);
+		}
+	}
+	if (strcmp(cfg.mode, "pair") == 0) {
+		for (size_t i = 0; i < cfg.clients; ++i) {
+			int fds[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds)) {
+				benchDieErrno("socketpair");
+			}
+			clients[i].fd = fds[0];
+			mockAdd(&mockThreads[i % cfg.serverThreads], fds[1]);
+		}
+	}
+	for (size_t i = 0; i < cfg.serverThreads; ++i) {
+		if (pthread_create(&mockThreads[i].thread, NULL, mockRun, &mockThreads[i])) {
+			benchDie("pthread_create failed");
+		}
+	}
+}
+
+static void mockStop(void) {
+	uint64_t v = 1;
+	if (write(mockStopFd, &v, sizeof(v)) != sizeof(v)) {
+		benchDieErrno("write");
+	}
+	for (size_t i = 0; i < cfg.serverThreads; ++i) {
+		pthread_join(mockThreads[i].thread, NULL);
+		close(mockThreads[i].epfd);
+	}
+	OPAFREE(mockThreads);
+	close(mockStopFd);
+	if (mockListenFd >= 0) {
+		close(mockListenFd);
+		if (strcmp(cfg.mode, "unix") == 0) {
+			unlink(cfg.path);
+		}
+	}
+}
+
+
+static benchClient* benchGetClient(opac* c) {
+	opacreactorConn* conn = list_entry(c, opacreactorConn, c);
+	return list_entry(conn, benchClient, conn);
+}
+
+static benchReq* benchGetReq(opacReq* r) {
+	opacReqAsync* ar = list_entry(r, opacReqAsync, rbase);
+	return list_entry(ar, benchReq, ar);
+}
+
+static void benchIssue(benchReq* br) {
+	benchClient* cl = br->cl;
+	uint8_t id[1 + OPAVI_MAXLEN64];
+	size_t idLen = 1;
+	if (cfg.async) {
+		opacid aid = opacGetAsyncId(&cl->conn.c, 0);
+		id[0] = OPADEF_POSVARINT;
+		idLen = opaviStore((uint64_t) aid, id + 1) - id;
+		opacReqAsyncInit(&br->ar, aid);
+	} else {
+		id[0] = OPADEF_NULL;
+		opacReqInit(&br->ar.rbase);
+	}
+	oparb rb;
+	oparbInit(&rb, id, idLen);
+	oparbAddStr(&rb, strlen(cfg.cmd), cfg.cmd);
+	oparbAddBin(&rb, cfg.payloadLen, cfg.payload);
+	oparbFinish(&rb);
+	if (rb.err) {
+		benchDie("error building request");
+	}
+	br->ar.rbase.rrbuff = rb.buff;
+	++cl->issued;
+	br->start = opaTimeNanos();
+	opacreactorQueueRequest(&cl->conn, &br->ar.rbase);
+}
+
+static void benchComplete(benchReq* br, int isErr) {
+	benchClient* cl = br->cl;
+	benchThread* t = cl->t;
+	opahistRecord(&t->hist, opaTimeNanos() - br->start);
+	if (isErr) {
+		++t->errors;
+	}
+	++cl->done;
+	if (t->failed) {
+		return;
+	}
+	if (cl->issued < cl->quota) {
+		benchIssue(br);
+	} else if (cl->done == cl->quota) {
+		--t->active;
+	}
+}
+
+static void benchOnResponse(opac* c, opacReq* r) {
+	UNUSED(c);
+	int isErr = opacReqResponseIsErr(r) > 0;
+	opacReqFreeResponse(r);
+	benchComplete(benchGetReq(r), isErr);
+}
+
+static void benchReqErr(opac* c, opacReq* r, opacReqErrReason reason, int errCode) {
+	UNUSED(c);
+	UNUSED(reason);
+	UNUSED(errCode);
+	if (!opacReqIsSent(r)) {
+		opacReqFreeRequest(r);
+	}
+	benchComplete(benchGetReq(r), 1);
+}
+
+static void benchClientErr(opac* c, int errCode) {
+	opa_fprintf(stderr, "client error %d\n", errCode);
+	benchGetClient(c)->t->failed = 1;
+}
+
+static void benchOnClose(opacreactorConn* conn, int err) {
+	opa_fprintf(stderr, "connection closed (err %d; errno %d)\n", err, conn->sysErr);
+	list_entry(conn, benchClient, conn)->t->failed = 1;
+}
+
+static const opacFuncs benchFuncs = {
+	.clientErr = benchClientErr,
+	.onResponse = benchOnResponse,
+	.reqErr = benchReqErr
+};
+
+static void* benchRun(void* arg) {
+	benchThread* t = arg;
+	if (opacreactorInit(&t->r)) {
+		benchDie("opacreactorInit failed");
+	}
+	for (size_t i = 0; i < t->numClients; ++i) {
+		benchClient* cl = &t->clients[i];
+		int err;
+		if (strcmp(cfg.mode, "tcp") == 0) {
+			err = opacreactorConnectTcp(&t->r, &cl->conn, cfg.host, cfg.port, &benchFuncs, 0);
+		} else if (strcmp(cfg.mode, "unix") == 0) {
+			err = opacreactorConnectUnix(&t->r, &cl->conn, cfg.path, &benchFuncs, 0);
+		} else {
+			err = opacreactorAddFd(&t->r, &cl->conn, cl->fd, &benchFuncs, 0);
+		}
+		if (err) {
+			benchDie("failed to connect");
+		}
+		cl->conn.onClose = benchOnClose;
+		if (cl->quota > 0) {
+			++t->active;
+		}
+	}
+
+	t->start = opaTimeNanos();
+	for (size_t i = 0; i < t->numClients; ++i) {
+		benchClient* cl = &t->clients[i];
+		for (size_t j = 0; j < cfg.pipeline && cl->issued < cl->quota; ++j) {
+			benchIssue(&cl->reqs[j]);
+		}
+	}
+	while (t->active > 0 && !t->failed) {
+		if (opacreactorRun(&t->r, 1000) < 0) {
+			t->failed = 1;
+		}
+	}
+	t->end = opaTimeNanos();
+
+	for (size_t i = 0; i < t->numClients; ++i) {
+		if (t->clients[i].conn.fd >= 0) {
+			opacreactorCloseConn(&t->clients[i].conn);
+		}
+	}
+	opacreactorClose(&t->r);
+	return NULL;
+}
+
+
+static size_t benchParseSize(const char* s) {
+	char* end;
+	unsigned long long v = strtoull(s, &end, 10);
+	if (*s == 0 || *end != 0) {
+		benchDie("invalid number");
+	}
+	return (size_t) v;
+}
+
+static void benchUsage(void) {
+	benchDie("usage: opabench [-c clients] [-n requests] [-P pipeline] [-d size] [-t threads] [-T serverThreads] [-a]\n"
+		"                [-m pair|tcp|unix] [-h host] [-p port] [-s path] [-e] [-r command] [-j]");
+}
+
+static void benchPrintResults(const benchThread* threads, uint64_t elapsed, uint64_t numDone) {
+	opahist h;
+	opahistInit(&h);
+	uint64_t errors = 0;
+	for (size_t i = 0; i < cfg.threads; ++i) {
+		opahistMerge(&h, &threads[i].hist);
+		errors += threads[i].errors;
+	}
+	double secs = (double) elapsed / 1e9;
+	double rps = secs > 0 ? (double) numDone / secs : 0;
+	double mbps = rps * (double) cfg.payloadLen / 1e6;
+	static const double pcts[] = {50, 90, 99, 99.9, 99.99};
+	static const char* pctNames[] = {"p50", "p90", "p99", "p999", "p9999"};
+	if (cfg.json) {
+		opa_printf("{\n  \"command\": \"%s\",\n  \"transport\": \"%s\",\n  \"clients\": %" OPA_FMT_ZU ",\n  \"threads\": %" OPA_FMT_ZU ",\n", cfg.cmd, cfg.mode, cfg.clients, cfg.threads);
+		opa_printf("  \"pipeline\": %" OPA_FMT_ZU ",\n  \"payload_bytes\": %" OPA_FMT_ZU ",\n  \"async\": %s,\n", cfg.pipeline, cfg.payloadLen, cfg.async ? "true" : "false");
+		opa_printf("  \"requests\": %llu,\n  \"errors\": %llu,\n  \"seconds\": %.6f,\n  \"requests_per_sec\": %.2f,\n  \"payload_mb_per_sec\": %.2f,\n", (unsigned long long) numDone, (unsigned long long) errors, secs, rps, mbps);
+		opa_printf("  \"latency_us\": {\"min\": %.3f, \"avg\": %.3f", (double) (h.count ? h.min : 0) / 1e3, h.count ? (double) h.sum / (double) h.count / 1e3 : 0.0);
+		for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); ++i) {
+			uint64_t v = opahistPercentile(&h, pcts[i]);
+			opa_printf(", \"%s\": %.3f", pctNames[i], (double) v / 1e3);
+		}
+		opa_printf(", \"max\": %.3f}\n}\n", (double) h.max / 1e3);
+	} else {
+		opa_printf("====== %s ======\n", cfg.cmd);
+		opa_printf("  %llu requests completed in %.3f seconds (%llu errors)\n", (unsigned long long) numDone, secs, (unsigned long long) errors);
+		opa_printf("  %" OPA_FMT_ZU " clients on %" OPA_FMT_ZU " threads; pipeline %" OPA_FMT_ZU "; %" OPA_FMT_ZU " byte payload; %s ids; transport %s%s\n",
+			cfg.clients, cfg.threads, cfg.pipeline, cfg.payloadLen, cfg.async ? "async" : "sync", cfg.mode, cfg.external ? " (external server)" : "");
+		opa_printf("\n  throughput: %.2f requests per second (%.2f MB/s of payload)\n", rps, mbps);
+		opa_printf("  latency (usec): min=%.3f avg=%.3f", (double) (h.count ? h.min : 0) / 1e3, h.count ? (double) h.sum / (double) h.count / 1e3 : 0.0);
+		for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); ++i) {
+			uint64_t v = opahistPercentile(&h, pcts[i]);
+			opa_printf(" %s=%.3f", pctNames[i], (double) v / 1e3);
+		}
+		opa_printf(" max=%.3f\n", (double) h.max / 1e3);
+	}
+}
+
+int main(int argc, char** argv) {
+	for (int i = 1; i < argc; ++i) {
+		const char* a = argv[i];
+		if (a[0] != '-' || a[1] == 0 || a[2] != 0) {
+			benchUsage();
+		}
+		if (a[1] == 'a') {
+			cfg.async = 1;
+			continue;
+		} else if (a[1] == 'e') {
+			cfg.external = 1;
+			continue;
+		} else if (a[1] == 'j') {
+			cfg.json = 1;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			benchUsage();
+		}
+		const char* v = argv[++i];
+		switch (a[1]) {
+			case 'c': cfg.clients = benchParseSize(v); break;
+			case 'n': cfg.requests = benchParseSize(v); break;
+			case 'P': cfg.pipeline = benchParseSize(v); break;
+			case 'd': cfg.payloadLen = benchParseSize(v); break;
+			case 't': cfg.threads = benchParseSize(v); break;
+			case 'T': cfg.serverThreads = benchParseSize(v); break;
+			case 'm': cfg.mode = v; break;
+			case 'h': cfg.host = v; break;
+			case 'p': cfg.port = v; break;
+			case 's': cfg.path = v; break;
+			case 'r': cfg.cmd = v; break;
+			default: benchUsage();
+		}
+	}
+	if (strcmp(cfg.mode, "pair") != 0 && strcmp(cfg.mode, "tcp") != 0 && strcmp(cfg.mode, "unix") != 0) {
+		benchUsage();
+	}
+	if (cfg.external && strcmp(cfg.mode, "pair") == 0) {
+		benchDie("-e requires -m tcp or -m unix");
+	}
+	if (cfg.clients == 0 || cfg.pipeline == 0 || cfg.threads == 0 || cfg.serverThreads == 0) {
+		benchDie("clients, pipeline and threads must be greater than 0");
+	}
+	if (cfg.threads > cfg.clients) {
+		cfg.threads = cfg.clients;
+	}
+	char pathBuff[64];
+	if (cfg.path == NULL) {
+		opa_snprintf(pathBuff, sizeof(pathBuff), "/tmp/opabench.%ld.sock", (long) getpid());
+		cfg.path = pathBuff;
+	}
+	if (cfg.external && cfg.port == NULL) {
+		cfg.port = "4567";
+	}
+
+	cfg.payload = OPAMALLOC(cfg.payloadLen + 1);
+	benchClient* clients = OPACALLOC(cfg.clients, sizeof(benchClient));
+	benchThread* threads = OPACALLOC(cfg.threads, sizeof(benchThread));
+	if (cfg.payload == NULL || clients == NULL || threads == NULL) {
+		benchDie("out of memory");
+	}
+	memset(cfg.payload, 'x', cfg.payloadLen);
+	for (size_t i = 0; i < cfg.clients; ++i) {
+		benchClient* cl = &clients[i];
+		cl->fd = -1;
+		cl->quota = cfg.requests / cfg.clients + (i < cfg.requests % cfg.clients ? 1 : 0);
+		cl->reqs = OPACALLOC(cfg.pipeline, sizeof(benchReq));
+		if (cl->reqs == NULL) {
+			benchDie("out of memory");
+		}
+		for (size_t j = 0; j < cfg.pipeline; ++j) {
+			cl->reqs[j].cl = cl;
+		}
+	}
+	for (size_t i = 0; i < cfg.threads; ++i) {
+		benchThread* t = &threads[i];
+		size_t first = i * cfg.clients / cfg.threads;
+		t->clients = &clients[first];
+		t->numClients = (i + 1) * cfg.clients / cfg.threads - first;
+		opahistInit(&t->hist);
+		for (size_t j = 0; j < t->numClients; ++j) {
+			t->clients[j].t = t;
+		}
+	}
+
+	if (!cfg.external) {
+		mockStart(clients);
+	}
+	for (size_t i = 0; i < cfg.threads; ++i) {
+		if (pthread_create(&threads[i].thread, NULL, benchRun, &threads[i])) {
+			benchDie("pthread_create failed");
+		}
+	}
+	int failed = 0;
+	uint64_t start = 0;
+	uint64_t end = 0;
+	uint64_t numDone = 0;
+	for (size_t i = 0; i < cfg.threads; ++i) {
+		pthread_join(threads[i].thread, NULL);
+		failed |= threads[i].failed;
+		start = (i == 0 || threads[i].start < start) ? threads[i].start : start;
+		end = threads[i].end > end ? threads[i].end : end;
+	}
+	for (size_t i = 0; i < cfg.clients; ++i) {
+		numDone += clients[i].done;
+	}
+	if (!cfg.external) {
+		mockStop();
+	}
+
+	benchPrintResults(threads, end - start, numDone);
+
+	for (size_t i = 0; i < cfg.clients; ++i) {
+		OPAFREE(clients[i].reqs);
+	}
+	OPAFREE(clients);
+	OPAFREE(threads);
+	OPAFREE(cfg.payload);
+	return failed ? 1 : 0;
+}
@@ -251,7 +251,7 @@ int opabuffAppend1(opabuff* b, uint8_t v) {
 
 int opabuffSetLen(opabuff* b, size_t newlen) {
 	if (newlen > b->len) {
-		int err = opabuffEnsureSpace(b, newlen);
+		int err = opabuffEnsureSpace(b, newlen - b->len);
 		if (!err) {
 			b->len = newlen;
 		}
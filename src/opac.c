@@ -6,29 +6,64 @@
 #include <string.h>
 
 #include "opac.h"
+#include "opacarena.h"
 #include "opacore.h"
+#include "opacprobes.h"
 #include "opaso.h"
 
 #ifdef OPA_NOTHREADS
 #define ATOMIC_INC64(v) (++(*(v)))
+#define ATOMIC_ADD64(v, n) ((*(v)) += (n))
+#define ATOMIC_LOAD64(v) (*(v))
+#define ATOMIC_STORE64(v, n) (*(v) = (n))
+#define ATOMIC_OR8_REL(v, n) ((*(v)) |= (n))
+#define ATOMIC_LOAD8_ACQ(v) (*(v))
 #else
 #ifdef _MSC_VER
 #define ATOMIC_INC64(v) InterlockedIncrement64((volatile LONG64*) (v))
+#define ATOMIC_ADD64(v, n) InterlockedExchangeAdd64((volatile LONG64*) (v), (n))
+#define ATOMIC_LOAD64(v) ((uint64_t) InterlockedCompareExchange64((volatile LONG64*) (v), 0, 0))
+#define ATOMIC_STORE64(v, n) InterlockedExchange64((volatile LONG64*) (v), (n))
+#define ATOMIC_OR8_REL(v, n) _InterlockedOr8((volatile char*) (v), (char) (n))
+#define ATOMIC_LOAD8_ACQ(v) ((unsigned char) _InterlockedOr8((volatile char*) (v), 0))
 #elif defined(__GNUC__)
 #define ATOMIC_INC64(v) __sync_add_and_fetch((v), 1)
+#define ATOMIC_ADD64(v, n) __atomic_fetch_add((v), (n), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD64(v) __atomic_load_n((v), __ATOMIC_RELAXED)
+#define ATOMIC_STORE64(v, n) __atomic_store_n((v), (n), __ATOMIC_RELAXED)
+#define ATOMIC_OR8_REL(v, n) __atomic_fetch_or((v), (n), __ATOMIC_RELEASE)
+#define ATOMIC_LOAD8_ACQ(v) __atomic_load_n((v), __ATOMIC_ACQUIRE)
 #endif
 #endif
 
+// counters in c->stats. STAT_ADD is for counters that only 1 thread modifies (the send thread or the parse
+//  thread) so a read-modify-write instruction is not needed; STAT_ADDMT is for counters modified by many threads
+#define STAT_ADD(c, field, n) ATOMIC_STORE64(&(c)->stats.field, ATOMIC_LOAD64(&(c)->stats.field) + (n))
+#define STAT_SET(c, field, n) ATOMIC_STORE64(&(c)->stats.field, (n))
+#define STAT_ADDMT(c, field, n) ATOMIC_ADD64(&(c)->stats.field, (n))
+
 #ifndef OPAC_READLEN
 #define OPAC_READLEN (1024 * 8)
 #endif
 
+// max bytes to read with 1 call when the remaining length of a large bin/str is known
+#ifndef OPAC_MAXREADLEN
+#define OPAC_MAXREADLEN (1024 * 1024 * 16)
+#endif
+
+// size of the buffer that request stream bytes are read into when they cannot be written from their source
+#ifndef OPAC_STREAMBUFFLEN
+#define OPAC_STREAMBUFFLEN (1024 * 64)
+#endif
+
 #define OPAC_F_ISASYNC       0x01
 #define OPAC_F_NORESPONSE    0x02
 #define OPAC_F_QUEUEDFORSEND 0x04
 #define OPAC_F_SENT          0x08
 #define OPAC_F_RESPONSERECVD 0x10
 #define OPAC_F_RESULTISERR   0x20
+#define OPAC_F_ARENA         0x40
+#define OPAC_F_STREAM        0x80
 
 int opacReqIsSent(const opacReq* r) {
 	return r->flags & OPAC_F_SENT;
@@ -46,9 +81,20 @@ const uint8_t* opacReqGetResponse(const opacReq* r) {
 	return opacReqResponseRecvd(r) ? r->pos : NULL;
 }
 
+// free rrbuff whether it is a normal buffer or was allocated from the client's response arena
+static void opacReqFreeBuff(opacReq* r) {
+	if (r->flags & OPAC_F_ARENA) {
+		opacarenaFree(r->rrbuff.data);
+		memset(&r->rrbuff, 0, sizeof(opabuff));
+		r->flags &= ~OPAC_F_ARENA;
+	} else {
+		opabuffFree(&r->rrbuff);
+	}
+}
+
 void opacReqFreeResponse(opacReq* r) {
 	if (opacReqResponseRecvd(r)) {
-		opabuffFree(&r->rrbuff);
+		opacReqFreeBuff(r);
 		r->pos = NULL;
 		// TODO: clear struct here?
 		//memset(r, 0, sizeof(opacReq));
@@ -63,6 +109,8 @@ void opacReqAsyncInit(opacReqAsync* r, opacid id) {
 	opacReqInit(&r->rbase);
 	r->idinfo.id = id;
 	r->rbase.flags |= OPAC_F_ISASYNC;
+	// opacClaimRequestById() removes the timer of every async request from the wheel
+	memset(&r->timer, 0, sizeof(r->timer));
 }
 
 void opacReqSetRequestBuff(opacReq* r, opabuff b) {
@@ -72,11 +120,56 @@ void opacReqSetRequestBuff(opacReq* r, opabuff b) {
 }
 
 void opacReqFreeRequest(opacReq* r) {
-	opabuffFree(&r->rrbuff);
+	opacReqFreeBuff(r);
+}
+
+void opacReqSetStreaming(opacReq* r) {
+	r->flags |= OPAC_F_STREAM;
+}
+
+void opacReqSetDeadline(opacReq* r, uint64_t deadline) {
+	r->deadline = deadline;
+}
+
+static void opacReqStreamInit(opacReqStream* s, size_t pos, uint64_t len) {
+	memset(s, 0, sizeof(opacReqStream));
+	s->pos = pos;
+	s->len = len;
+	s->fd = -1;
+}
+
+void opacReqStreamInitMem(opacReqStream* s, size_t pos, const void* data, uint64_t len) {
+	opacReqStreamInit(s, pos, len);
+	s->data = data;
+}
+
+void opacReqStreamInitFd(opacReqStream* s, size_t pos, int fd, uint64_t offset, uint64_t len) {
+	opacReqStreamInit(s, pos, len);
+	s->fd = fd;
+	s->offset = offset;
+}
+
+void opacReqStreamInitCb(opacReqStream* s, size_t pos, uint64_t len, int (*read)(opacReqStream* s, void* buff, size_t len, size_t* pNumRead), void* udata) {
+	opacReqStreamInit(s, pos, len);
+	s->read = read;
+	s->udata = udata;
+}
+
+void opacReqAddStream(opacReq* r, opacReqStream* s) {
+	opacReqStream** next = &r->streams;
+	while (*next != NULL) {
+		next = &(*next)->next;
+	}
+	s->next = NULL;
+	*next = s;
 }
 
 
 static void opacHandleErr(opac* c, int err) {
+	OPAC_PROBE2(client__error, c, err);
+	if (err == OPA_ERR_PARSE) {
+		STAT_ADDMT(c, parseErrorsTotal, 1);
+	}
 	c->err = err;
 	if (c->cbs->clientErr != NULL) {
 		c->cbs->clientErr(c, err);
@@ -84,48 +177,327 @@ static void opacHandleErr(opac* c, int err) {
 }
 
 static void opacHandleReqErr(opac* c, opacReq* r, opacReqErrReason reason, int errCode) {
+	STAT_ADDMT(c, reqErrorsTotal, 1);
+	if (reason == OPAC_RER_TIMEOUT) {
+		STAT_ADDMT(c, timeoutsTotal, 1);
+	}
 	if (c->cbs->reqErr != NULL) {
 		c->cbs->reqErr(c, r, reason, errCode);
 	} else {
-		opabuffFree(&r->rrbuff);
+		opacReqFreeBuff(r);
 		r->pos = NULL;
 	}
 }
 
+#ifndef OPAC_NOLATENCY
+// return pointer to the byte after the varint at pos; or NULL if the varint does not end before end
+static const uint8_t* opacVarintEnd(const uint8_t* pos, const uint8_t* end) {
+	for (; pos < end; ++pos) {
+		if (!(*pos & 0x80)) {
+			return pos + 1;
+		}
+	}
+	return NULL;
+}
+
+// find the command name (the string after the asyncid). the name must be before the first stream
+static int opacReqCmdName(const opacReq* r, const uint8_t** pName, size_t* pLen) {
+	const uint8_t* start = opabuffGetPos(&r->rrbuff, 0);
+	const uint8_t* end = start + (r->streams != NULL ? r->streams->pos : opabuffGetLen(&r->rrbuff));
+	const uint8_t* pos = start + 1;
+	if (pos >= end) {
+		return 0;
+	}
+	if (*pos == OPADEF_POSVARINT || *pos == OPADEF_NEGVARINT) {
+		pos = opacVarintEnd(pos + 1, end);
+	} else {
+		++pos;
+	}
+	if (pos == NULL || pos >= end) {
+		return 0;
+	}
+	if (*pos == OPADEF_STR_EMPTY) {
+		*pName = pos;
+		*pLen = 0;
+		return 1;
+	}
+	const uint8_t* name = *pos == OPADEF_STR_LPVI ? opacVarintEnd(pos + 1, end) : NULL;
+	if (name == NULL) {
+		return 0;
+	}
+	// note: the request has not been validated; an invalid length must not panic (opaviLoad)
+	uint64_t len;
+	if (opaviLoadWithErr(pos + 1, &len, NULL) || len > (uint64_t) (end - name)) {
+		return 0;
+	}
+	*pName = name;
+	*pLen = (size_t) len;
+	return 1;
+}
+
+static void opacReqStartTiming(opac* c, opacReq* r) {
+	r->times.sendStart = opaTimeNanos();
+	r->times.cmd = NULL;
+	const uint8_t* name;
+	size_t len;
+	if (!(r->flags & OPAC_F_NORESPONSE) && opacReqCmdName(r, &name, &len)) {
+		r->times.cmd = opaclatGetCmd(c->lat, name, len);
+	}
+}
+#endif
+
 static opacReq* opacNextQueuedRequest(opac* c) {
 	while (1) {
 		opaqueueItem* qi = opaqueuePoll(&c->reqsToSend);
 		if (qi == NULL) {
 			return NULL;
 		}
+		STAT_ADDMT(c, numToSend, (uint64_t) -1);
 		opacReq* r = list_entry(qi, opacReq, qi);
 		if (opabuffGetLen(&r->rrbuff) == 0) {
 			opacHandleReqErr(c, r, OPAC_RER_INVREQ, 0);
 			continue;
 		}
+		if (r->deadline != 0 && r->deadline <= ATOMIC_LOAD64(&c->now)) {
+			// drop expired request before any of it is written
+			opacHandleReqErr(c, r, OPAC_RER_TIMEOUT, 0);
+			continue;
+		}
+		#ifndef OPAC_NOLATENCY
+			if (c->lat != NULL) {
+				opacReqStartTiming(c, r);
+			}
+		#endif
 		// note: must add request to mainReqs or asyncReqs before it is sent completely. otherwise
 		//  if there are separate send/recv threads then the response could be received while send
 		//  thread is paused.
 		if (!(r->flags & OPAC_F_ISASYNC)) {
 			if (!(r->flags & OPAC_F_NORESPONSE)) {
+				STAT_ADDMT(c, numMain, 1);
 				opaqueuePush(&c->mainReqs, qi);
 			}
 		} else {
 			opacReqAsync* ar = list_entry(r, opacReqAsync, rbase);
-			if (!opacidmapAdd(&c->asyncReqs, &ar->idinfo)) {
+			int res = opacidmapAdd(&c->asyncReqs, &ar->idinfo);
+			if (res == 0) {
 				// an id is not added to idmap if it already exists in the idmap
 				opacHandleReqErr(c, r, OPAC_RER_IDEXISTS, 0);
 				continue;
+			} else if (res < 0) {
+				opacHandleReqErr(c, r, OPAC_RER_ERR, res);
+				continue;
+			}
+			STAT_ADDMT(c, numAsync, 1);
+			if (r->deadline != 0 && ar->idinfo.id > 0) {
+				ar->timer.deadline = r->deadline;
+				opacwheelLock(&c->timers);
+				ATOMIC_OR8_REL(&c->hasTimers, 1);
+				res = opacwheelAdd(&c->timers, &ar->timer, ATOMIC_LOAD64(&c->now));
+				opacwheelUnlock(&c->timers);
+				if (res) {
+					opacidmapGet(&c->asyncReqs, ar->idinfo.id, 1);
+					STAT_ADDMT(c, numAsync, (uint64_t) -1);
+					opacHandleReqErr(c, r, OPAC_RER_ERR, res);
+					continue;
+				}
 			}
 		}
+		OPAC_PROBE2(send__start, c, r);
 		return r;
 	}
 }
 
+static void opacReqWritten(opac* c, opacReq* r) {
+	OPAC_PROBE2(send__done, c, r);
+	// a request with a deadline is returned (reqErr) by opacCheckTimeouts() as soon as it is marked as sent,
+	//  possibly from another thread; therefore it is only marked after onSent is done with it. other requests
+	//  are marked first because onSent may be the last callback (and the request can be reused in it)
+	int timed = (r->flags & OPAC_F_ISASYNC) && r->deadline != 0;
+	if (!timed) {
+		r->flags |= OPAC_F_SENT;
+	}
+	#ifndef OPAC_NOLATENCY
+		if (c->lat != NULL) {
+			r->times.sent = opaTimeNanos();
+		}
+	#endif
+	if (c->cbs->onSent != NULL) {
+		c->cbs->onSent(c, r);
+	} else {
+		opabuffFree(&r->rrbuff);
+	}
+	if (timed) {
+		ATOMIC_OR8_REL(&r->flags, OPAC_F_SENT);
+	}
+}
+
+static int opacStreamReadFd(opacReqStream* s, void* buff, size_t len, size_t* pNumRead) {
+	// note: OPA_ERR_EOF if the file is shorter than the length in the request's header
+	return opacoreReadAt(s->fd, s->offset + s->sent, buff, len, pNumRead);
+}
+
+// return non-zero if the stream's bytes are sent with the sendfile callback
+static int opacStreamIsFile(const opac* c, const opacReqStream* s) {
+	return s->data == NULL && s->read == NULL && c->cbs->sendfile != NULL;
+}
+
+// get the next contiguous bytes of r to write. bytes of a stream are read into c->streamBuff if they cannot be
+//  written from their source. if the bytes must be written with the sendfile callback then *pFile is set to the
+//  stream (and seg->buff is NULL)
+static int opacReqNextSeg(opac* c, opacReq* r, opacIoVec* seg, opacReqStream** pFile) {
+	const uint8_t* start = opabuffGetPos(&r->rrbuff, 0);
+	opacReqStream* s = r->streams;
+	while (s != NULL && r->pos == start + s->pos && s->sent == s->len) {
+		// empty stream
+		s = r->streams = s->next;
+	}
+	if (s == NULL || r->pos != start + s->pos) {
+		seg->buff = r->pos;
+		seg->len = (s == NULL ? start + opabuffGetLen(&r->rrbuff) : start + s->pos) - r->pos;
+		return 0;
+	}
+	uint64_t remain = s->len - s->sent;
+	if (s->data != NULL) {
+		seg->buff = s->data + s->sent;
+		seg->len = remain < SIZE_MAX ? (size_t) remain : SIZE_MAX;
+	} else if (opacStreamIsFile(c, s)) {
+		seg->buff = NULL;
+		seg->len = remain < SIZE_MAX ? (size_t) remain : SIZE_MAX;
+		*pFile = s;
+	} else {
+		if (c->streamBuffPos == c->streamBuffLen) {
+			if (c->streamBuff == NULL) {
+				c->streamBuff = OPAMALLOC(OPAC_STREAMBUFFLEN);
+				if (c->streamBuff == NULL) {
+					return OPA_ERR_NOMEM;
+				}
+				STAT_SET(c, sendBuffBytes, OPAC_STREAMBUFFLEN);
+			}
+			size_t len = remain < OPAC_STREAMBUFFLEN ? (size_t) remain : OPAC_STREAMBUFFLEN;
+			size_t numRead = 0;
+			int err = s->read != NULL ? s->read(s, c->streamBuff, len, &numRead) : opacStreamReadFd(s, c->streamBuff, len, &numRead);
+			if (!err && (numRead == 0 || numRead > len)) {
+				err = OPA_ERR_INTERNAL;
+			}
+			if (err) {
+				return err;
+			}
+			c->streamBuffPos = 0;
+			c->streamBuffLen = numRead;
+		}
+		seg->buff = c->streamBuff + c->streamBuffPos;
+		seg->len = c->streamBuffLen - c->streamBuffPos;
+	}
+	return 0;
+}
+
+// mark n bytes of the segment returned by opacReqNextSeg() as written. return non-zero if r has been written completely
+static int opacReqAdvance(opac* c, opacReq* r, size_t n) {
+	const uint8_t* start = opabuffGetPos(&r->rrbuff, 0);
+	opacReqStream* s = r->streams;
+	if (s != NULL && r->pos == start + s->pos) {
+		s->sent += n;
+		if (s->data == NULL && !opacStreamIsFile(c, s)) {
+			c->streamBuffPos += n;
+		}
+		if (s->sent == s->len) {
+			r->streams = s->next;
+		}
+		return 0;
+	}
+	r->pos += n;
+	return r->streams == NULL && r->pos == start + opabuffGetLen(&r->rrbuff);
+}
+
+static size_t opacCountWrite(opac* c, size_t numWritten) {
+	STAT_ADD(c, writeCallsTotal, 1);
+	if (numWritten == 0) {
+		STAT_ADD(c, writeStallsTotal, 1);
+	} else {
+		STAT_ADD(c, bytesWrittenTotal, numWritten);
+	}
+	return numWritten;
+}
+
+// write the segment returned by opacReqNextSeg(); return number of bytes written
+static size_t opacWriteSeg(opac* c, const opacIoVec* seg, const opacReqStream* file) {
+	if (file != NULL) {
+		return opacCountWrite(c, c->cbs->sendfile(c, file->fd, file->offset + file->sent, seg->len));
+	}
+	return opacCountWrite(c, c->cbs->write(c, seg->buff, seg->len));
+}
+
+static void opacSendRequestsV(opac* c) {
+	opacIoVec iov[OPAC_WRITEVLEN];
+	while (1) {
+		while (c->sendBatchLen < OPAC_WRITEVLEN) {
+			opacReq* r = opacNextQueuedRequest(c);
+			if (r == NULL) {
+				break;
+			}
+			c->sendBatch[c->sendBatchLen++] = r;
+		}
+		if (c->sendBatchLen == 0) {
+			break;
+		}
+
+		// note: only the last request in iov can have more bytes to write after its segment. a segment that
+		//  must be written with sendfile is written by itself
+		unsigned int numReqs = 0;
+		opacReqStream* file = NULL;
+		while (numReqs < c->sendBatchLen) {
+			opacReqStream* f = NULL;
+			opacReq* r = c->sendBatch[numReqs];
+			int err = opacReqNextSeg(c, r, &iov[numReqs], &f);
+			if (err) {
+				opacHandleErr(c, err);
+				return;
+			}
+			if (f != NULL) {
+				if (numReqs == 0) {
+					file = f;
+					numReqs = 1;
+				}
+				break;
+			}
+			++numReqs;
+			if (r->streams != NULL) {
+				break;
+			}
+		}
+		size_t numWritten = file != NULL ? opacWriteSeg(c, &iov[0], file) : opacCountWrite(c, c->cbs->writev(c, iov, numReqs));
+		if (numWritten == 0) {
+			break;
+		}
+
+		// note: callbacks may be invoked below; therefore remove written requests from the batch first
+		unsigned int numDone = 0;
+		for (unsigned int i = 0; i < numReqs && numWritten > 0; ++i) {
+			size_t n = numWritten < iov[i].len ? numWritten : iov[i].len;
+			numWritten -= n;
+			if (opacReqAdvance(c, c->sendBatch[i], n)) {
+				++numDone;
+			}
+		}
+		opacReq* done[OPAC_WRITEVLEN];
+		memcpy(done, c->sendBatch, numDone * sizeof(opacReq*));
+		memmove(c->sendBatch, c->sendBatch + numDone, (c->sendBatchLen - numDone) * sizeof(opacReq*));
+		c->sendBatchLen -= numDone;
+
+		for (unsigned int i = 0; i < numDone; ++i) {
+			opacReqWritten(c, done[i]);
+		}
+	}
+}
+
 void opacSendRequests(opac* c) {
 	if (c->err || c->closed) {
 		return;
 	}
+	if (c->cbs->writev != NULL) {
+		opacSendRequestsV(c);
+		return;
+	}
 	opacReq* r;
 	if (c->currSendReq != NULL) {
 		r = c->currSendReq;
@@ -134,21 +506,22 @@ void opacSendRequests(opac* c) {
 		r = opacNextQueuedRequest(c);
 	}
 	while (r != NULL) {
-		// TODO: add a buffer to minimize write calls? in case requests are tiny
-		size_t numToWrite = opabuffGetPos(&r->rrbuff, opabuffGetLen(&r->rrbuff)) - r->pos;
-		size_t numWritten = c->cbs->write(c, r->pos, numToWrite);
+		// note: if requests are tiny then provide a writev callback to minimize write calls
+		opacIoVec seg;
+		opacReqStream* file = NULL;
+		int err = opacReqNextSeg(c, r, &seg, &file);
+		if (err) {
+			c->currSendReq = r;
+			opacHandleErr(c, err);
+			break;
+		}
+		size_t numWritten = opacWriteSeg(c, &seg, file);
 		if (numWritten == 0) {
 			c->currSendReq = r;
 			break;
 		}
-		r->pos += numWritten;
-		if (numWritten == numToWrite) {
-			r->flags |= OPAC_F_SENT;
-			if (c->cbs->onSent != NULL) {
-				c->cbs->onSent(c, r);
-			} else {
-				opabuffFree(&r->rrbuff);
-			}
+		if (opacReqAdvance(c, r, numWritten)) {
+			opacReqWritten(c, r);
 			r = opacNextQueuedRequest(c);
 		}
 	}
@@ -226,6 +599,24 @@ static opacReq* opacGetRequestById(opac* c, opacid id, int remove) {
 	return idinfo == NULL ? NULL : &((list_entry(idinfo, opacReqAsync, idinfo))->rbase);
 }
 
+// find an async request that is receiving its response and remove it from c->timers so that it cannot expire.
+//  the lookup is done while holding the timers lock because opacCheckTimeouts() removes expired requests from
+//  asyncReqs while holding the lock. note: the lock is also required to read c->timers.slots (it is allocated
+//  when the first request with a deadline is added to the wheel). if no request has ever been given a deadline
+//  then the lock is skipped so that clients that do not use deadlines do not pay for them
+static opacReq* opacClaimRequestById(opac* c, opacid id, int remove) {
+	if (!ATOMIC_LOAD8_ACQ(&c->hasTimers)) {
+		return opacGetRequestById(c, id, remove);
+	}
+	opacwheelLock(&c->timers);
+	opacReq* r = opacGetRequestById(c, id, remove);
+	if (r != NULL && c->timers.slots != NULL) {
+		opacwheelRemove(&c->timers, &list_entry(r, opacReqAsync, rbase)->timer);
+	}
+	opacwheelUnlock(&c->timers);
+	return r;
+}
+
 /*
 static int opacCheckUtf8(const uint8_t* buff) {
 	// TODO: also check for huge array depth and huge big int vals that exceed a configurable limit?
@@ -251,8 +642,35 @@ static int opacCheckUtf8(const uint8_t* buff) {
 }
 */
 
-static int opacOnResponse(opac* c) {
-	const uint8_t* buff = opabuffGetPos(&c->currResponse, 0);
+// the whole bin/str result of a streaming request was received at once. pass it to onChunk and replace it
+//  with an empty value (same as when the result is streamed as it is received)
+static void opacStreamWhole(opac* c, opacReq* r, opabuff* resp, size_t resultPos) {
+	uint8_t* data = opabuffGetPos(resp, 0);
+	uint8_t* val = data + resultPos;
+	const uint8_t* payload;
+	size_t vlen = (size_t) opaviLoad(val + 1, &payload);
+	c->cbs->onChunk(c, r, payload, vlen, 0);
+	size_t tailPos = (payload - data) + vlen;
+	size_t len = opabuffGetLen(resp);
+	*val = *val == OPADEF_BIN_LPVI ? OPADEF_BIN_EMPTY : OPADEF_STR_EMPTY;
+	memmove(val + 1, data + tailPos, len - tailPos);
+	opabuffSetLen(resp, resultPos + 1 + (len - tailPos));
+}
+
+static void opacFreeRespBuff(opabuff* resp, int inArena) {
+	if (inArena) {
+		opacarenaFree(resp->data);
+		memset(resp, 0, sizeof(opabuff));
+	} else {
+		opabuffFree(resp);
+	}
+}
+
+// note: if a request is found for the response then resp is moved to the request's rrbuff and zero'd.
+//  inArena is non-zero if resp was allocated from c->arena
+static int opacOnResponse(opac* c, opabuff* resp, int inArena) {
+	STAT_ADD(c, responsesTotal, 1);
+	const uint8_t* buff = opabuffGetPos(resp, 0);
 	if (*buff != OPADEF_ARRAY_START) {
 		return OPA_ERR_PARSE;
 	}
@@ -260,24 +678,40 @@ static int opacOnResponse(opac* c) {
 	//	// TODO: if there is a utf-8 encoding error then do not close connection? invoke callback with utf8 error?
 	//	return OPA_ERR_PARSE;
 	//}
-	++buff;
-	if (*buff == OPADEF_ARRAY_END) {
-		return OPA_ERR_PARSE;
-	}
 	const uint8_t* errObj = NULL;
-	const uint8_t* asyncId = buff;
-	buff += opasolen(buff);
-	if (*buff == OPADEF_ARRAY_END) {
-		return OPA_ERR_PARSE;
-	}
-	const uint8_t* result = buff;
-	buff += opasolen(buff);
-	if (*buff != OPADEF_ARRAY_END) {
-		errObj = buff;
+	const uint8_t* asyncId;
+	const uint8_t* result;
+	const opapp* pp = &c->pp;
+	if (pp->indexLen > 0 && pp->index[pp->indexLen - 1] == opabuffGetLen(resp) - 1) {
+		// the parser recorded where each element starts (and where the closing ']' is) while scanning the
+		//  response. note: the offsets do not match if a streamed result was removed from the response
+		if (pp->indexLen < 3 || pp->indexLen > 4) {
+			return OPA_ERR_PARSE;
+		}
+		asyncId = buff + pp->index[0];
+		result = buff + pp->index[1];
+		if (pp->indexLen == 4) {
+			errObj = buff + pp->index[2];
+		}
+	} else {
+		++buff;
+		if (*buff == OPADEF_ARRAY_END) {
+			return OPA_ERR_PARSE;
+		}
+		asyncId = buff;
 		buff += opasolen(buff);
-		if (*buff != OPADEF_ARRAY_END) {
+		if (*buff == OPADEF_ARRAY_END) {
 			return OPA_ERR_PARSE;
 		}
+		result = buff;
+		buff += opasolen(buff);
+		if (*buff != OPADEF_ARRAY_END) {
+			errObj = buff;
+			buff += opasolen(buff);
+			if (*buff != OPADEF_ARRAY_END) {
+				return OPA_ERR_PARSE;
+			}
+		}
 	}
 
 	if (errObj != NULL && *errObj != OPADEF_NULL) {
@@ -300,28 +734,45 @@ static int opacOnResponse(opac* c) {
 	// at this point the server response should conform to spec
 
 	opacReq* r = NULL;
+	int persistent = 0;
 	if (*asyncId != OPADEF_NULL) {
 		if (*asyncId == OPADEF_POSVARINT) {
 			uint64_t id = opaviLoad(asyncId + 1, NULL);
 			if (id <= INT64_MAX) {
-				r = opacGetRequestById(c, id, 1);
+				r = opacClaimRequestById(c, id, 1);
+				if (r != NULL) {
+					STAT_ADDMT(c, numAsync, (uint64_t) -1);
+				}
 			}
 		} else if (*asyncId == OPADEF_NEGVARINT) {
 			uint64_t id = opaviLoad(asyncId + 1, NULL);
 			if (id <= INT64_MAX) {
 				r = opacGetRequestById(c, 0 - id, 0);
+				persistent = 1;
 			}
 		} else if (opasoIsNumber(*asyncId)) {
 			// note: according to specs, server cannot change asyncid. must respond with exact same bytes as request
 		}
 		if (r == NULL) {
 			if (c->cbs->unknownAsyncId != NULL) {
-				c->cbs->unknownAsyncId(c, c->currResponse);
+				if (inArena) {
+					// callback frees the buffer with opabuffFree() so arena memory cannot be passed
+					opabuff copy = opabuffNew(opabuffGetLen(resp));
+					int err = opabuffAppend(&copy, opabuffGetPos(resp, 0), opabuffGetLen(resp));
+					opacFreeRespBuff(resp, inArena);
+					if (err) {
+						return err;
+					}
+					c->cbs->unknownAsyncId(c, copy);
+				} else {
+					c->cbs->unknownAsyncId(c, *resp);
+					memset(resp, 0, sizeof(opabuff));
+				}
 			} else {
 				char* idStr = opasoStringify(asyncId, NULL);
 				OPALOGERRF("unknown async-id %s", idStr == NULL ? "" : idStr);
 				OPAFREE(idStr);
-				opabuffFree(&c->currResponse);
+				opacFreeRespBuff(resp, inArena);
 			}
 		}
 	} else {
@@ -331,13 +782,29 @@ static int opacOnResponse(opac* c) {
 			OPALOGERR("recv extra response");
 			return OPA_ERR_PARSE;
 		}
+		STAT_ADDMT(c, numMain, (uint64_t) -1);
 		r = list_entry(qi, opacReq, qi);
 	}
 
 	if (r != NULL) {
+		#ifndef OPAC_NOLATENCY
+			if (c->lat != NULL && !persistent) {
+				opaclatRecord(c->lat, &r->times, opaTimeNanos());
+			}
+		#endif
+		if ((r->flags & OPAC_F_STREAM) && !persistent && errObj == NULL && c->cbs->onChunk != NULL &&
+				(*result == OPADEF_BIN_LPVI || *result == OPADEF_STR_LPVI)) {
+			// note: result is still at the same position after this; only the bytes after it move
+			opacStreamWhole(c, r, resp, result - opabuffGetPos(resp, 0));
+		}
 		r->flags |= OPAC_F_RESPONSERECVD;
-		r->rrbuff = c->currResponse;
-		memset(&c->currResponse, 0, sizeof(c->currResponse));
+		if (inArena) {
+			r->flags |= OPAC_F_ARENA;
+		} else {
+			r->flags &= ~OPAC_F_ARENA;
+		}
+		r->rrbuff = *resp;
+		memset(resp, 0, sizeof(opabuff));
 		if (errObj == NULL) {
 			//r->resultIsErr = 0;
 			r->pos = result;
@@ -345,7 +812,13 @@ static int opacOnResponse(opac* c) {
 			r->flags |= OPAC_F_RESULTISERR;
 			r->pos = errObj;
 		}
-		if (c->cbs->onResponse != NULL) {
+		OPAC_PROBE3(response__dispatch, c, r, errObj != NULL);
+		if (c->useCompletions && !persistent) {
+			// note: r->qi is not in use; request was removed from mainReqs or was never in a queue (async)
+			if (opaqueuePush(&c->completions, &r->qi) && c->cbs->completionsReady != NULL) {
+				c->cbs->completionsReady(c);
+			}
+		} else if (c->cbs->onResponse != NULL) {
 			c->cbs->onResponse(c, r);
 		}
 	}
@@ -353,45 +826,407 @@ static int opacOnResponse(opac* c) {
 	return 0;
 }
 
-void opacParseResponses(opac* c) {
-	SASSERT(OPAC_READLEN > 1);
-	if (c->err || c->closed) {
-		return;
+// copy a complete response (from the arena if enabled) and dispatch it
+static int opacDispatchCopy(opac* c, const uint8_t* src, size_t len) {
+	opabuff resp;
+	int inArena = 0;
+	int err = 0;
+	uint8_t* adata = c->arena != NULL ? opacarenaAlloc(c->arena, len) : NULL;
+	if (adata != NULL) {
+		memcpy(adata, src, len);
+		resp.data = adata;
+		resp.len = len;
+		resp.cap = len;
+		resp.flags = 0;
+		inArena = 1;
+	} else {
+		resp = opabuffNew(len);
+		err = opabuffAppend(&resp, src, len);
+	}
+	if (!err) {
+		err = opacOnResponse(c, &resp, inArena);
+	}
+	opacFreeRespBuff(&resp, inArena);
+	return err;
+}
+
+// dispatch the complete response stored in c->currResponse at [start, *pEnd). *pEnd is set to the position
+//  in c->currResponse where the next response starts
+static int opacDispatchResponse(opac* c, size_t start, size_t* pEnd) {
+	size_t end = *pEnd;
+	if (start == 0 && end >= c->readLen) {
+		// large response: hand the receive buffer to the response rather than copying the response.
+		//  only the bytes that follow the response (if any) are copied into a new receive buffer
+		opabuff resp = c->currResponse;
+		size_t remain = opabuffGetLen(&resp) - end;
+		c->currResponse = opabuffNew(remain + c->readLen);
+		if (remain > 0) {
+			int err = opabuffSetLen(&c->currResponse, remain + 1);
+			if (err) {
+				opabuffFree(&resp);
+				return err;
+			}
+			// note: copy the null terminator that follows the received bytes
+			memcpy(opabuffGetPos(&c->currResponse, 0), opabuffGetPos(&resp, end), remain + 1);
+			opabuffSetLen(&c->currResponse, remain);
+		}
+		opabuffSetLen(&resp, end);
+		*pEnd = 0;
+		int err = opacOnResponse(c, &resp, 0);
+		opabuffFree(&resp);
+		return err;
 	}
+	return opacDispatchCopy(c, opabuffGetPos(&c->currResponse, start), end - start);
+}
+
+// find and dispatch all complete responses in c->currResponse. bytes before scanPos have already been scanned.
+// after returning, c->currResponse only contains the bytes of a partial response (if any)
+static int opacParseRecvd(opac* c, size_t scanPos, size_t* pNumResponses) {
 	int err = 0;
-	uint8_t buff[OPAC_READLEN];
+	size_t respStart = 0;
+	while (scanPos < opabuffGetLen(&c->currResponse)) {
+		const uint8_t* pos = opabuffGetPos(&c->currResponse, scanPos);
+		const uint8_t* end;
+		err = opappFindEnd(&c->pp, pos, opabuffGetLen(&c->currResponse) - scanPos, &end, NULL);
+		if (err || end == NULL) {
+			break;
+		}
+		size_t respEnd = scanPos + (end - pos);
+		OPAC_PROBE2(response__end, c, respEnd - respStart);
+		err = opacDispatchResponse(c, respStart, &respEnd);
+		if (err) {
+			break;
+		}
+		++*pNumResponses;
+		respStart = scanPos = respEnd;
+	}
+	if (!err && respStart > 0) {
+		// move partial response to start of buffer. note: capacity is kept for the next read
+		size_t remain = opabuffGetLen(&c->currResponse) - respStart;
+		uint8_t* data = opabuffGetPos(&c->currResponse, 0);
+		memmove(data, data + respStart, remain);
+		opabuffSetLen(&c->currResponse, remain);
+	}
+	return err;
+}
 
-	size_t numRead = c->cbs->read(c, buff, OPAC_READLEN - 1);
-	if (numRead == 0) {
+// find the request that a response with the specified asyncid belongs to without removing it
+static opacReq* opacFindPendingReq(opac* c, const uint8_t* asyncId) {
+	if (*asyncId == OPADEF_NULL) {
+		opaqueueItem* qi = opaqueuePeek(&c->mainReqs);
+		return qi == NULL ? NULL : list_entry(qi, opacReq, qi);
+	} else if (*asyncId == OPADEF_POSVARINT) {
+		uint64_t id = opaviLoad(asyncId + 1, NULL);
+		return id <= INT64_MAX ? opacClaimRequestById(c, id, 0) : NULL;
+	}
+	// note: persistent requests are not streamed
+	return NULL;
+}
+
+// if the partial response in c->currResponse is receiving the bin/str result of a streaming request then pass
+//  the result's bytes to onChunk and stop buffering them. the result is replaced with an empty value
+static void opacStreamStart(opac* c) {
+	if (c->cbs->onChunk == NULL || c->streamReq != NULL || c->pp.arrayDepth != 1 || opappBytesRemaining(&c->pp) == 0) {
 		return;
 	}
-	buff[numRead] = 0;
+	// note: the parser is in the middle of a top level value of the response so the asyncid and the header
+	//  of the value after it are complete
+	uint8_t* buff = opabuffGetPos(&c->currResponse, 0);
+	const uint8_t* asyncId = buff + 1;
+	if (*asyncId != OPADEF_NULL && *asyncId != OPADEF_POSVARINT) {
+		return;
+	}
+	uint8_t* val = buff + 1 + opasolen(asyncId);
+	if (*val != OPADEF_BIN_LPVI && *val != OPADEF_STR_LPVI) {
+		return;
+	}
+	const uint8_t* payload;
+	uint64_t vlen = opaviLoad(val + 1, &payload);
+	size_t present = opabuffGetLen(&c->currResponse) - (payload - buff);
+	if (present >= vlen) {
+		// result is complete; the partial value is the error object
+		return;
+	}
+	opacReq* r = opacFindPendingReq(c, asyncId);
+	if (r == NULL || !(r->flags & OPAC_F_STREAM)) {
+		return;
+	}
+	c->streamReq = r;
+	c->streamRemain = vlen - present;
+	if (present > 0) {
+		c->cbs->onChunk(c, r, payload, present, c->streamRemain);
+	}
+	*val = *val == OPADEF_BIN_LPVI ? OPADEF_BIN_EMPTY : OPADEF_STR_EMPTY;
+	size_t len = (val - buff) + 1;
+	opabuffSetLen(&c->currResponse, len);
+	*opabuffGetPos(&c->currResponse, len) = 0;
+}
 
-	const uint8_t* pos = buff;
+// pass the bytes at the start of data that belong to the result being streamed to onChunk. data[len] must
+//  be writable. *pUsed is set to the number of bytes that were passed to onChunk
+static int opacStreamRecvd(opac* c, uint8_t* data, size_t len, size_t* pUsed) {
+	size_t num = c->streamRemain < len ? (size_t) c->streamRemain : len;
+	// note: the parser still checks the bytes (ie, utf-8) and tracks the remaining length of the value.
+	//  it requires a null char after the last byte
+	uint8_t next = data[num];
+	data[num] = 0;
 	const uint8_t* end;
-	while (!err) {
-		err = opappFindEnd(&c->pp, pos, numRead, &end, NULL);
-		if (!err && end == NULL) {
-			// end of response was not found
-			err = opabuffAppend(&c->currResponse, pos, numRead);
+	int err = opappFindEnd(&c->pp, data, num, &end, NULL);
+	data[num] = next;
+	if (err) {
+		return err;
+	}
+	OASSERT(end == NULL);
+	opacReq* r = c->streamReq;
+	c->streamRemain -= num;
+	if (c->streamRemain == 0) {
+		c->streamReq = NULL;
+	}
+	c->cbs->onChunk(c, r, data, num, c->streamRemain);
+	*pUsed = num;
+	return 0;
+}
+
+// read once and dispatch all complete responses. return error code
+static int opacReadAndParse(opac* c, size_t* pNumRead, size_t* pNumResponses) {
+	// read directly into the spare capacity of the receive buffer. if the parser is in the middle
+	//  of a large bin/str then make room for all of its remaining bytes (up to a limit)
+	size_t readLen = c->readLen;
+	uint64_t valRemain = opappBytesRemaining(&c->pp);
+	if (valRemain > readLen && c->streamReq == NULL) {
+		readLen = valRemain < OPAC_MAXREADLEN ? (size_t) valRemain : OPAC_MAXREADLEN;
+	}
+	size_t prevLen = opabuffGetLen(&c->currResponse);
+	int err = opabuffSetLen(&c->currResponse, prevLen + readLen + 1);
+	if (err) {
+		return err;
+	}
+	size_t numRead = c->cbs->read(c, opabuffGetPos(&c->currResponse, prevLen), readLen);
+	opabuffSetLen(&c->currResponse, prevLen + numRead);
+	*pNumRead = numRead;
+	STAT_ADD(c, readCallsTotal, 1);
+	STAT_ADD(c, bytesReadTotal, numRead);
+	STAT_SET(c, recvBuffBytes, c->currResponse.cap);
+	if (numRead == 0) {
+		return 0;
+	}
+	// note: parser requires a null char after the last byte; space was reserved above
+	*opabuffGetPos(&c->currResponse, prevLen + numRead) = 0;
+
+	if (c->streamReq != NULL) {
+		// streamed bytes are removed from the receive buffer
+		uint8_t* data = opabuffGetPos(&c->currResponse, prevLen);
+		size_t used;
+		err = opacStreamRecvd(c, data, numRead, &used);
+		if (err) {
+			return err;
+		}
+		memmove(data, data + used, numRead - used + 1);
+		opabuffSetLen(&c->currResponse, prevLen + numRead - used);
+	}
+	err = opacParseRecvd(c, prevLen, pNumResponses);
+	if (!err) {
+		opacStreamStart(c);
+	}
+	return err;
+}
+
+int opacParseResponses(opac* c) {
+	if (c->err || c->closed) {
+		return 0;
+	}
+	size_t totRead = 0;
+	size_t numResponses = 0;
+	while (1) {
+		size_t numRead;
+		int err = opacReadAndParse(c, &numRead, &numResponses);
+		if (err) {
+			// errors that can occur: OPA_ERR_NOMEM, OPA_ERR_PARSE
+			opacHandleErr(c, err);
+			return 0;
+		}
+		if (numRead == 0) {
+			return 0;
+		}
+		totRead += numRead;
+		if ((c->readBudget > 0 && totRead >= c->readBudget) || (c->respBudget > 0 && numResponses >= c->respBudget)) {
+			return 1;
+		}
+	}
+}
+
+// dispatch complete responses directly from data (not c->currResponse, which must be empty). bytes of
+//  a partial response at the end of data are copied to c->currResponse
+static int opacParseExternal(opac* c, const uint8_t* data, size_t len, size_t* pNumResponses) {
+	const uint8_t* start = data;
+	const uint8_t* stop = data + len;
+	while (start < stop) {
+		const uint8_t* end;
+		int err = opappFindEnd(&c->pp, start, stop - start, &end, NULL);
+		if (err) {
+			return err;
+		}
+		if (end == NULL) {
 			break;
 		}
-		if (!err) {
-			OASSERT(end > pos && end <= pos + numRead);
-			err = opabuffAppend(&c->currResponse, pos, end - pos);
+		OPAC_PROBE2(response__end, c, (size_t) (end - start));
+		err = opacDispatchCopy(c, start, end - start);
+		if (err) {
+			return err;
 		}
-		if (!err) {
-			// a complete response has been read
-			err = opacOnResponse(c);
+		++*pNumResponses;
+		start = end;
+	}
+	if (start < stop) {
+		// note: parser has already scanned these bytes; copy the null terminator too
+		size_t remain = stop - start;
+		int err = opabuffSetLen(&c->currResponse, remain + 1);
+		if (err) {
+			return err;
 		}
-		numRead -= end - pos;
-		pos = end;
+		memcpy(opabuffGetPos(&c->currResponse, 0), start, remain + 1);
+		opabuffSetLen(&c->currResponse, remain);
 	}
+	return 0;
+}
 
+int opacParseData(opac* c, uint8_t* data, size_t len) {
+	if (c->err || c->closed) {
+		return c->err ? c->err : OPA_ERR_INVSTATE;
+	}
+	STAT_ADD(c, bytesReadTotal, len);
+	size_t numResponses = 0;
+	int err = 0;
+	if (c->streamReq != NULL) {
+		size_t used;
+		err = opacStreamRecvd(c, data, len, &used);
+		data += used;
+		len -= used;
+	}
+	size_t prevLen = opabuffGetLen(&c->currResponse);
+	if (err) {
+		// fall through to error handling below
+	} else if (prevLen == 0) {
+		data[len] = 0;
+		err = opacParseExternal(c, data, len, &numResponses);
+	} else {
+		// continuing a partial response: append and scan the new bytes
+		err = opabuffSetLen(&c->currResponse, prevLen + len + 1);
+		if (!err) {
+			memcpy(opabuffGetPos(&c->currResponse, prevLen), data, len);
+			opabuffSetLen(&c->currResponse, prevLen + len);
+			*opabuffGetPos(&c->currResponse, prevLen + len) = 0;
+			err = opacParseRecvd(c, prevLen, &numResponses);
+		}
+	}
 	if (err) {
-		// errors that can occur: OPA_ERR_NOMEM, OPA_ERR_PARSE
 		opacHandleErr(c, err);
+	} else {
+		opacStreamStart(c);
 	}
+	STAT_SET(c, recvBuffBytes, c->currResponse.cap);
+	return err;
+}
+
+void opacEnableCompletions(opac* c) {
+	c->useCompletions = 1;
+}
+
+size_t opacPollCompletions(opac* c, opacReq** reqs, size_t max) {
+	size_t num = 0;
+	while (num < max) {
+		opaqueueItem* qi = opaqueuePoll(&c->completions);
+		if (qi == NULL) {
+			break;
+		}
+		reqs[num++] = list_entry(qi, opacReq, qi);
+	}
+	return num;
+}
+
+int opacEnableArena(opac* c) {
+	if (c->arena == NULL) {
+		c->arena = opacarenaNew();
+		if (c->arena == NULL) {
+			return OPA_ERR_NOMEM;
+		}
+	}
+	return 0;
+}
+
+void opacGetStats(opac* c, opacStats* stats) {
+	stats->bytesReadTotal = ATOMIC_LOAD64(&c->stats.bytesReadTotal);
+	stats->bytesWrittenTotal = ATOMIC_LOAD64(&c->stats.bytesWrittenTotal);
+	stats->readCallsTotal = ATOMIC_LOAD64(&c->stats.readCallsTotal);
+	stats->writeCallsTotal = ATOMIC_LOAD64(&c->stats.writeCallsTotal);
+	stats->writeStallsTotal = ATOMIC_LOAD64(&c->stats.writeStallsTotal);
+	stats->responsesTotal = ATOMIC_LOAD64(&c->stats.responsesTotal);
+	stats->parseErrorsTotal = ATOMIC_LOAD64(&c->stats.parseErrorsTotal);
+	stats->reqErrorsTotal = ATOMIC_LOAD64(&c->stats.reqErrorsTotal);
+	stats->timeoutsTotal = ATOMIC_LOAD64(&c->stats.timeoutsTotal);
+	stats->numToSend = ATOMIC_LOAD64(&c->stats.numToSend);
+	stats->numMain = ATOMIC_LOAD64(&c->stats.numMain);
+	stats->numAsync = ATOMIC_LOAD64(&c->stats.numAsync);
+	stats->recvBuffBytes = ATOMIC_LOAD64(&c->stats.recvBuffBytes);
+	stats->sendBuffBytes = ATOMIC_LOAD64(&c->stats.sendBuffBytes);
+}
+
+#ifndef OPAC_NOLATENCY
+
+int opacEnableLatency(opac* c) {
+	if (c->lat == NULL) {
+		#ifndef OPA_NOTHREADS
+			c->lat = opaclatNew(c->asyncReqs.sync);
+		#else
+			c->lat = opaclatNew(0);
+		#endif
+		if (c->lat == NULL) {
+			return OPA_ERR_NOMEM;
+		}
+	}
+	return 0;
+}
+
+int opacGetLatency(opac* c, const char* cmd, size_t cmdLen, opacLatency* lat) {
+	return c->lat == NULL ? OPA_ERR_INVSTATE : opaclatGet(c->lat, cmd, cmdLen, lat);
+}
+
+int opacGetLatencyCmd(opac* c, size_t idx, const char** pName, size_t* pLen) {
+	return c->lat == NULL ? OPA_ERR_INVSTATE : opaclatGetName(c->lat, idx, pName, pLen);
+}
+
+#else
+
+int opacEnableLatency(opac* c) {
+	UNUSED(c);
+	return OPA_ERR_UNSUPPORTED;
+}
+
+int opacGetLatency(opac* c, const char* cmd, size_t cmdLen, opacLatency* lat) {
+	UNUSED(c);
+	UNUSED(cmd);
+	UNUSED(cmdLen);
+	UNUSED(lat);
+	return OPA_ERR_UNSUPPORTED;
+}
+
+int opacGetLatencyCmd(opac* c, size_t idx, const char** pName, size_t* pLen) {
+	UNUSED(c);
+	UNUSED(idx);
+	UNUSED(pName);
+	UNUSED(pLen);
+	return OPA_ERR_UNSUPPORTED;
+}
+
+#endif
+
+void opacSetReadLen(opac* c, size_t len) {
+	c->readLen = len > 0 ? len : OPAC_READLEN;
+}
+
+void opacSetReadBudget(opac* c, size_t maxBytes, size_t maxResponses) {
+	c->readBudget = maxBytes;
+	c->respBudget = maxResponses;
 }
 
 opacid opacGetAsyncId(opac* c, int persistent) {
@@ -402,10 +1237,67 @@ opacid opacGetAsyncId(opac* c, int persistent) {
 
 int opacRemovePersistent(opac* c, opacReqAsync* r) {
 	opacidmapItem* i = opacidmapGet(&c->asyncReqs, r->idinfo.id, 1);
+	if (i != NULL) {
+		STAT_ADDMT(c, numAsync, (uint64_t) -1);
+	}
 	return i != NULL;
 }
 
-void opacQueueRequest(opac* c, opacReq* r) {
+typedef struct {
+	opac* c;
+	opacwheelItem* expired; // list of requests that were removed from asyncReqs (linked with next)
+	size_t count;
+} opacTimeoutCtx;
+
+static void opacTimeoutCB(void* context, opacwheelItem* i) {
+	opacTimeoutCtx* ctx = context;
+	opac* c = ctx->c;
+	opacReqAsync* ar = list_entry(i, opacReqAsync, timer);
+	if (!(ATOMIC_LOAD8_ACQ(&ar->rbase.flags) & OPAC_F_SENT)) {
+		// request is still being written (or onSent is running) and cannot be returned yet; check again on the next tick
+		opacwheelAdd(&c->timers, i, c->timers.now);
+		return;
+	}
+	if (opacidmapGet(&c->asyncReqs, ar->idinfo.id, 1) == NULL) {
+		// response was received and is being handled
+		return;
+	}
+	STAT_ADDMT(c, numAsync, (uint64_t) -1);
+	i->next = ctx->expired;
+	ctx->expired = i;
+	++ctx->count;
+}
+
+size_t opacCheckTimeouts(opac* c, uint64_t now) {
+	ATOMIC_STORE64(&c->now, now);
+	opacTimeoutCtx ctx = {c, NULL, 0};
+	opacwheelLock(&c->timers);
+	if (c->timers.slots != NULL) {
+		opacwheelAdvance(&c->timers, now, &ctx, opacTimeoutCB);
+	}
+	opacwheelUnlock(&c->timers);
+	while (ctx.expired != NULL) {
+		opacwheelItem* i = ctx.expired;
+		ctx.expired = i->next;
+		i->next = NULL;
+		opacHandleReqErr(c, &list_entry(i, opacReqAsync, timer)->rbase, OPAC_RER_TIMEOUT, 0);
+	}
+	return ctx.count;
+}
+
+// streams must be in order and inserted after the start of the request and before its end
+static int opacReqStreamsValid(const opacReq* r) {
+	size_t pos = 1;
+	for (const opacReqStream* s = r->streams; s != NULL; s = s->next) {
+		if (s->pos < pos || s->pos >= opabuffGetLen(&r->rrbuff) || s->sent != 0) {
+			return 0;
+		}
+		pos = s->pos;
+	}
+	return 1;
+}
+
+int opacQueueRequest(opac* c, opacReq* r) {
 	OASSERT((r->flags & (OPAC_F_QUEUEDFORSEND | OPAC_F_SENT | OPAC_F_RESPONSERECVD | OPAC_F_RESULTISERR)) == 0);
 
 	if (opabuffGetLen(&r->rrbuff) > 2) {
@@ -431,32 +1323,49 @@ void opacQueueRequest(opac* c, opacReq* r) {
 	} else {
 		goto InvalidReq;
 	}
+	if (!opacReqStreamsValid(r)) {
+		goto InvalidReq;
+	}
 
 	if (c->err || c->closed) {
 		opacHandleReqErr(c, r, OPAC_RER_CLOSED, 0);
-		return;
+		return 0;
 	}
 
+	#ifndef OPAC_NOLATENCY
+		if (c->lat != NULL) {
+			r->times.queued = opaTimeNanos();
+		}
+	#endif
 	r->pos = opabuffGetPos(&r->rrbuff, 0);
 	r->flags |= OPAC_F_QUEUEDFORSEND;
-	opaqueuePush(&c->reqsToSend, &r->qi);
-	return;
+	STAT_ADDMT(c, numToSend, 1);
+	OPAC_PROBE2(request__queue, c, r);
+	return opaqueuePush(&c->reqsToSend, &r->qi);
 
 	InvalidReq:
 	opacHandleReqErr(c, r, OPAC_RER_INVREQ, 0);
+	return 0;
 }
 
 static void opacInitInternal(opac* c, const opacFuncs* funcs) {
+	SASSERT(OPAC_READLEN > 0);
 	OASSERT(funcs != NULL && funcs->read != NULL && funcs->write != NULL);
 	memset(c, 0, sizeof(opac));
 	c->cbs = funcs;
+	c->readLen = OPAC_READLEN;
+	c->readBudget = 1;
+	// note: opacOnResponse() uses the offsets of the response's elements rather than walking the response
+	c->pp.trackIndex = 1;
 }
 
 void opacInit(opac* c, const opacFuncs* funcs) {
 	opacInitInternal(c, funcs);
 	opaqueueInit(&c->reqsToSend);
 	opaqueueInit(&c->mainReqs);
+	opaqueueInit(&c->completions);
 	opacidmapInit(&c->asyncReqs);
+	opacwheelInit(&c->timers);
 }
 
 int opacIsOpen(opac* c) {
@@ -468,16 +1377,17 @@ void opacInitMT(opac* c, const opacFuncs* funcs) {
 	opacInitInternal(c, funcs);
 	opaqueueInitMT(&c->reqsToSend);
 	opaqueueInitMT(&c->mainReqs);
+	opaqueueInitMT(&c->completions);
 	opacidmapInitMT(&c->asyncReqs);
+	opacwheelInitMT(&c->timers);
 }
 #endif
 
 static void opacCloseReq(opac* c, opacReq* r) {
-	if (r == c->currSendReq) {
-		// should have already called opacHandleReqErr() for this
+	if (!opacReqIsSent(r)) {
+		// must be c->currSendReq or in c->sendBatch; should have already called opacHandleReqErr() for this
 		return;
 	}
-	OASSERT(opacReqIsSent(r));
 	opacHandleReqErr(c, r, OPAC_RER_CLOSED, 0);
 }
 
@@ -492,11 +1402,14 @@ void opacClose(opac* c) {
 	}
 	c->closed = 1;
 
-	// note: c->currSendReq is added to mainReqs or asyncReqs (or neither if has NULL asyncid)
+	// note: c->currSendReq and c->sendBatch are added to mainReqs or asyncReqs (or neither if has NULL asyncid)
 	//  therefore, it is important to remember this in opacCloseReq() above
 	if (c->currSendReq != NULL) {
 		opacHandleReqErr(c, c->currSendReq, OPAC_RER_CLOSED, 0);
 	}
+	for (unsigned int i = 0; i < c->sendBatchLen; ++i) {
+		opacHandleReqErr(c, c->sendBatch[i], OPAC_RER_CLOSED, 0);
+	}
 
 	while (1) {
 		opaqueueItem* qi = opaqueuePoll(&c->reqsToSend);
@@ -517,12 +1430,31 @@ void opacClose(opac* c) {
 
 	opacidmapIterate(&c->asyncReqs, c, opacCloseAsyncCB);
 	opacidmapClose(&c->asyncReqs);
+	opacwheelClose(&c->timers);
 #ifndef OPA_NOTHREADS
 	opaqueueClose(&c->mainReqs);
 	opaqueueClose(&c->reqsToSend);
 #endif
 
 	c->currSendReq = NULL;
+	c->sendBatchLen = 0;
+	c->streamReq = NULL;
+	STAT_SET(c, numToSend, 0);
+	STAT_SET(c, numMain, 0);
+	STAT_SET(c, numAsync, 0);
 
 	opabuffFree(&c->currResponse);
+	OPAFREE(c->streamBuff);
+	c->streamBuff = NULL;
+	c->streamBuffPos = c->streamBuffLen = 0;
+	STAT_SET(c, recvBuffBytes, 0);
+	STAT_SET(c, sendBuffBytes, 0);
+	if (c->arena != NULL) {
+		opacarenaClose(c->arena);
+		c->arena = NULL;
+	}
+	#ifndef OPAC_NOLATENCY
+		opaclatFree(c->lat);
+		c->lat = NULL;
+	#endif
 }
@@ -8,22 +8,57 @@
 
 #include "opabuff.h"
 #include "opacidmap.h"
+#include "opaclat.h"
+#include "opacstats.h"
 #include "opapp.h"
 #include "opaqueue.h"
+#include "opacwheel.h"
 
 
+typedef struct opacReqStream_s opacReqStream;
+
+struct opacReqStream_s {
+	opacReqStream* next;
+	size_t pos;          // offset in the request's rrbuff where the bytes are inserted when sending
+	uint64_t len;        // number of bytes to insert
+	uint64_t sent;       // number of bytes that have been written
+	const uint8_t* data; // bytes are sent from here (ie, mmap'd region); NULL if bytes are from read or fd
+	// read up to len bytes (starting at s->sent) into buff. store the number of bytes read in *pNumRead; must be
+	//  non-zero if 0 is returned. return 0 on success; else error code (the client cannot continue)
+	int (*read)(opacReqStream* s, void* buff, size_t len, size_t* pNumRead);
+	int fd;              // file that bytes are sent from if data and read are NULL
+	uint64_t offset;     // offset in fd of the first byte
+	void* udata;
+};
+
 typedef struct {
 	opaqueueItem qi;
 	opabuff rrbuff;      // stores request before/during serialization; then response when received
 	const uint8_t* pos;  // when request is being serialized, stores write pos; when response received, stores pos of result or error
+	opacReqStream* streams; // bytes that are inserted into rrbuff when the request is sent (see opacReqAddStream)
+	uint64_t deadline;   // see opacReqSetDeadline(); 0 if request does not expire
+#ifndef OPAC_NOLATENCY
+	opacReqTimes times;  // see opacEnableLatency()
+#endif
 	unsigned char flags;
 } opacReq;
 
 typedef struct {
 	opacReq rbase;
 	opacidmapItem idinfo;
+	opacwheelItem timer; // in opac's timers while the request is waiting for a response and has a deadline
 } opacReqAsync;
 
+// max number of requests that are gathered into a single call to the writev callback
+#ifndef OPAC_WRITEVLEN
+#define OPAC_WRITEVLEN 64
+#endif
+
+typedef struct {
+	const void* buff;
+	size_t len;
+} opacIoVec;
+
 typedef struct {
 	int err;
 	char closed;
@@ -33,18 +68,48 @@ typedef struct {
 	opaqueue reqsToSend;  // requests that are waiting to be sent
 	opacReq* currSendReq; // partially sent request
 
+	opacReq* sendBatch[OPAC_WRITEVLEN]; // requests removed from reqsToSend that are being written with writev (first may be partially sent)
+	unsigned int sendBatchLen;
+
+	uint8_t* streamBuff;   // bytes of a request stream that were read from its source but not written yet
+	size_t streamBuffPos;
+	size_t streamBuffLen;
+
 	opaqueue mainReqs;    // all non-async requests that have been sent and are waiting for a response from server
 	opacidmap asyncReqs;  // all async requests that have been sent and are waiting for a response from server
 
 	opapp pp;
 	opabuff currResponse;
+
+	size_t readLen;     // number of bytes to request from read callback (larger if a big value is being received)
+	size_t readBudget;  // opacParseResponses stops reading after this many bytes (0 for no limit)
+	size_t respBudget;  // opacParseResponses stops reading after this many responses (0 for no limit)
+
+	struct opacarena_s* arena; // small responses are allocated from here if enabled with opacEnableArena()
+
+	char useCompletions;
+	opaqueue completions; // requests with a response that have not been polled with opacPollCompletions()
+
+	opacReq* streamReq;    // request whose bin/str result is being passed to onChunk as it is received
+	uint64_t streamRemain; // bytes of streamReq's result that have not been received yet
+
+	opacwheel timers;      // async requests with a deadline that are waiting for a response
+	unsigned char hasTimers; // set before the first request is added to timers; read without the timers lock
+	uint64_t now;          // time passed to the last call of opacCheckTimeouts()
+
+#ifndef OPAC_NOLATENCY
+	opaclat* lat;          // latency histograms if enabled with opacEnableLatency()
+#endif
+
+	opacStats stats;       // updated with relaxed atomics; use opacGetStats() to read
 } opac;
 
 typedef enum {
 	OPAC_RER_INVREQ = 1,  // invalid request
 	OPAC_RER_IDEXISTS,    // async id already exists (internal error, should not happen)
 	OPAC_RER_ERR,         // an error occurred (ie, out of memory). see errCode
-	OPAC_RER_CLOSED       // client is closed or encountered an error and cannot continue
+	OPAC_RER_CLOSED,      // client is closed or encountered an error and cannot continue
+	OPAC_RER_TIMEOUT      // request's deadline passed before it was sent or before its response was received
 } opacReqErrReason;
 
 typedef struct opacFuncs_s {
@@ -71,6 +136,25 @@ typedef struct opacFuncs_s {
 	// function that is called when client receives a message with an asyncid that was never sent by client; null for default handling
 	// note: if not null, then function is responsible for freeing the buffer with opabuffFree()
 	void (*unknownAsyncId)(opac* c, opabuff rawData);
+
+	// try to write all bytes from iovcnt buffers (in order). return total number of bytes written. return 0 to indicate
+	//  EWOULDBLOCK/CLOSED/error. can be null; if not null then it is used rather than write() so that many queued
+	//  requests can be sent with 1 call
+	size_t (*writev)(opac* c, const opacIoVec* iov, int iovcnt);
+
+	// function that is called when a response is added to the completion queue and the queue was empty (see
+	//  opacEnableCompletions). can be null. use it to wake the thread that calls opacPollCompletions()
+	void (*completionsReady)(opac* c);
+
+	// function that is called with the bytes of a bin/str result as they are received for a request that
+	//  was marked with opacReqSetStreaming(). remaining is the number of bytes that have not been received
+	//  yet (0 for the last chunk). data is only valid during the call. can be null (streaming is disabled)
+	void (*onChunk)(opac* c, opacReq* r, const uint8_t* data, size_t len, uint64_t remaining);
+
+	// try to write len bytes from the file fd (starting at offset) without copying them (ie, sendfile). return number
+	//  of bytes written. return 0 to indicate EWOULDBLOCK/CLOSED/error. can be null; if null then request streams that
+	//  are sourced from a file are read into a buffer and written with write/writev
+	size_t (*sendfile)(opac* c, int fd, uint64_t offset, size_t len);
 } opacFuncs;
 
 typedef struct {
@@ -94,6 +178,62 @@ void opacReqSetRequestBuff(opacReq* r, opabuff b);
 void opacReqFreeRequest(opacReq* r);
 void opacReqFreeResponse(opacReq* r);
 
+/**
+ * Pass the request's bin/str result to the client's onChunk callback as it is received rather than
+ * buffering the whole value. Only the rest of the response is buffered; the result in the response
+ * passed to onResponse is replaced with an empty bin/str. Errors and results of other types are
+ * delivered normally. Must be called after opacReqSetRequestBuff() and before the request is queued.
+ * Persistent requests are not streamed.
+ */
+void opacReqSetStreaming(opacReq* r);
+
+/**
+ * Set the time when the request expires. Time is in milliseconds on a clock chosen by the caller (ie, a
+ * monotonic clock); the same clock must be passed to opacCheckTimeouts(). An expired request that has
+ * not been sent yet is dropped when it is taken from the queue (before any of it is written). An expired
+ * async request that is waiting for its response is removed when opacCheckTimeouts() is called; a late
+ * response is then handled like a response with an unknown asyncid. Non-async requests cannot expire
+ * once they are sent because responses are matched to them in order. Expired requests are passed to
+ * reqErr with OPAC_RER_TIMEOUT. Persistent requests only expire before they are sent. A request whose
+ * result is being streamed to onChunk no longer expires. Must be called before the request is queued.
+ * @param r Request
+ * @param deadline Time when the request expires; 0 for no deadline
+ */
+void opacReqSetDeadline(opacReq* r, uint64_t deadline);
+
+/**
+ * Initialize a request stream whose bytes are sent from memory (ie, a mmap'd file). data must remain
+ * valid until the request is passed to onSent or reqErr.
+ * @param s Stream
+ * @param pos Offset in the request where the bytes are inserted (see oparbAddBinHeader)
+ * @param data Bytes to send
+ * @param len Number of bytes
+ */
+void opacReqStreamInitMem(opacReqStream* s, size_t pos, const void* data, uint64_t len);
+
+/**
+ * Initialize a request stream whose bytes are sent from a file. If the client has a sendfile callback then
+ * the bytes are passed to it; else they are read with pread (not supported on Windows). fd must remain
+ * open until the request is passed to onSent or reqErr.
+ */
+void opacReqStreamInitFd(opacReqStream* s, size_t pos, int fd, uint64_t offset, uint64_t len);
+
+/**
+ * Initialize a request stream whose bytes are produced by a callback when the request is being sent.
+ * The callback is invoked from opacSendRequests().
+ */
+void opacReqStreamInitCb(opacReqStream* s, size_t pos, uint64_t len, int (*read)(opacReqStream* s, void* buff, size_t len, size_t* pNumRead), void* udata);
+
+/**
+ * Add a stream of bytes that are inserted into the request when it is sent rather than copied into the
+ * request's buffer. Use oparbAddBinHeader() or oparbAddStrHeader() to write the header of a bin/str
+ * argument; the stream's bytes (len must match the header) are inserted at the returned offset.
+ * Streams must be added in order of pos after opacReqSetRequestBuff() and before the request is queued.
+ * If an error occurs while reading a stream's source then the client cannot continue (clientErr is called)
+ * because the request has been partially written.
+ */
+void opacReqAddStream(opacReq* r, opacReqStream* s);
+
 /**
  * Determine whether request has been sent
  * @param r Request/response object to check
@@ -165,8 +305,10 @@ int opacIsOpen(opac* c);
  * Queue a request that will be sent eventually when opacSendRequests() is called.
  * @param c Client
  * @param r Request to send
+ * @return non-zero if the queue of requests to send was empty before this request was added (ie,
+ *   a writer may need to be woken up); 0 if queue was not empty or request was not queued
  */
-void opacQueueRequest(opac* c, opacReq* r);
+int opacQueueRequest(opac* c, opacReq* r);
 
 /**
  * Get a unique async id that can be used in a request.
@@ -190,10 +332,121 @@ int opacRemovePersistent(opac* c, opacReqAsync* r);
 void opacSendRequests(opac* c);
 
 /**
- * Try to recv and parse responses from server. Stops when read callback returns 0.
+ * Try to recv and parse responses from server. Stops when read callback returns 0 or when the
+ * budget set with opacSetReadBudget() is used up. By default, the read callback is called once.
+ * @param c Client
+ * @return non-zero if stopped because of the budget (more bytes may be available to read); else 0
+ */
+int opacParseResponses(opac* c);
+
+/**
+ * Parse bytes that were received without the read callback (ie, completion based io where the
+ * buffer is filled before the client is notified). Complete responses are dispatched before this
+ * returns; bytes of a partial response are copied so the caller can reuse data right away.
+ * @param c Client
+ * @param data Received bytes. data[len] must be writable; it is set to 0 (parser requires a null terminator)
+ * @param len Number of bytes received
+ * @return 0 on success; else error code (the client's clientErr callback is also invoked)
+ */
+int opacParseData(opac* c, uint8_t* data, size_t len);
+
+/**
+ * Rather than calling onResponse for each response from within opacParseResponses(), add completed
+ * requests to a queue that is drained with opacPollCompletions(). Responses to persistent requests
+ * are still passed to onResponse (a persistent request can have many responses). Must be called
+ * before any requests are queued.
+ * @param c Client
+ */
+void opacEnableCompletions(opac* c);
+
+/**
+ * Remove up to max completed requests from the completion queue (in the order that responses were
+ * received). Each request's response must be freed with opacReqFreeResponse(). Can be called by 1
+ * thread at a time; if the client was initialized with opacInitMT() then this can run at the same
+ * time as opacParseResponses(). Requests that completed before opacClose() can still be polled after
+ * it is called.
+ * @param c Client
+ * @param reqs Array that is filled with completed requests
+ * @param max Max number of requests to remove
+ * @return number of requests stored in reqs
+ */
+size_t opacPollCompletions(opac* c, opacReq** reqs, size_t max);
+
+/**
+ * Allocate small responses from slabs that are shared by the responses parsed around the same time
+ * rather than allocating each response separately. A slab is reused once all of its responses have
+ * been freed with opacReqFreeResponse(). When enabled, a response's rrbuff must only be freed with
+ * opacReqFreeResponse() (not opabuffFree) and must not be resized. Responses can be freed after the
+ * client is closed and from any thread.
+ * @param c Client
+ * @return 0 on success; else error code
+ */
+int opacEnableArena(opac* c);
+
+/**
+ * Record the latency of each request that receives a response (except persistent requests). Requests
+ * are timestamped with opaTimeNanos() when they are queued, taken from the queue to be written, fully
+ * written and when the response is received. The latency is recorded for all requests and for each
+ * command name (the first string after the asyncid) so that time spent queued in the client can be
+ * told apart from time spent waiting for the server. Must be called before any requests are queued.
+ * @param c Client
+ * @return 0 on success; else error code (OPA_ERR_UNSUPPORTED if compiled with OPAC_NOLATENCY)
+ */
+int opacEnableLatency(opac* c);
+
+/**
+ * Copy the latency histograms of a command. Use opahistPercentile() to get p50/p99/p999 from them.
+ * @param c Client
+ * @param cmd Command name; NULL for all requests
+ * @param cmdLen Number of bytes in cmd
+ * @param lat Copy of the histograms
+ * @return 0 on success; else error code (latency is not enabled or the command has not been seen)
+ */
+int opacGetLatency(opac* c, const char* cmd, size_t cmdLen, opacLatency* lat);
+
+/**
+ * Get the name of the idx'th command that latency is recorded for (up to OPAC_LAT_MAXCMDS commands are
+ * recorded separately). The name is valid until the client is closed.
+ * @return 0 on success; else error code (ie, idx is out of range)
+ */
+int opacGetLatencyCmd(opac* c, size_t idx, const char** pName, size_t* pLen);
+
+/**
+ * Get a snapshot of the client's counters. Can be called from any thread; each counter is read
+ * atomically but the counters are not read at the same instant.
+ * @param c Client
+ * @param stats Where the counters are copied
+ */
+void opacGetStats(opac* c, opacStats* stats);
+
+/**
+ * Set the number of bytes requested from the read callback with each call. Default is OPAC_READLEN.
+ * @param c Client
+ * @param len Number of bytes to read; 0 to use the default
+ */
+void opacSetReadLen(opac* c, size_t len);
+
+/**
+ * Set how much opacParseResponses() can read before it returns. It keeps calling the read callback
+ * until the callback returns 0 or the limits are reached (limits are checked after each read). The
+ * default is maxBytes=1 and maxResponses=0 (read callback is called once per opacParseResponses call).
+ * Use opacSetReadBudget(c, 0, 0) to read until the read callback returns 0 (ie, edge-triggered io).
+ * @param c Client
+ * @param maxBytes Stop reading when this many bytes have been read; 0 for no limit
+ * @param maxResponses Stop reading when this many responses have been parsed; 0 for no limit
+ */
+void opacSetReadBudget(opac* c, size_t maxBytes, size_t maxResponses);
+
+/**
+ * Expire requests whose deadline is at or before now (see opacReqSetDeadline). Call this periodically
+ * (ie, from an event loop timer). The time is also used to drop expired requests before they are sent.
+ * Can be called by 1 thread at a time; if the client was initialized with opacInitMT() then this can run
+ * at the same time as opacSendRequests() and opacParseResponses().
  * @param c Client
+ * @param now Current time (same clock as the deadlines)
+ * @return number of requests that were passed to reqErr with OPAC_RER_TIMEOUT
  */
-void opacParseResponses(opac* c);
+size_t opacCheckTimeouts(opac* c, uint64_t now);
 
 /**
  * Close client. Any remaining requests that have not been fully sent or have been
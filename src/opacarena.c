@@ -0,0 +1,167 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "opacarena.h"
+#include "opacore.h"
+
+#ifdef OPA_NOTHREADS
+#define ATOMIC_INC(v) (++(*(v)))
+#define ATOMIC_DEC(v) (--(*(v)))
+#else
+#ifdef _MSC_VER
+#define ATOMIC_INC(v) InterlockedIncrement((volatile LONG*) (v))
+#define ATOMIC_DEC(v) InterlockedDecrement((volatile LONG*) (v))
+#elif defined(__GNUC__)
+#define ATOMIC_INC(v) __sync_add_and_fetch((v), 1)
+#define ATOMIC_DEC(v) __sync_sub_and_fetch((v), 1)
+#endif
+#endif
+
+// each allocation is prefixed with a pointer to its slab. allocations are 8 byte aligned
+#define OPAC_ARENA_HDRLEN 8
+#define OPAC_ARENA_ALIGN(len) (((len) + 7) & ~((size_t) 7))
+
+struct opacarenaSlab_s {
+	opacarenaSlab* next;
+	opacarena* arena;
+	volatile int32_t refs; // 1 for each allocation, plus 1 while slab is the arena's current slab
+};
+
+#define OPAC_ARENA_SLABHDRLEN OPAC_ARENA_ALIGN(sizeof(opacarenaSlab))
+
+
+static void opacarenaLock(opacarena* a) {
+	#ifndef OPA_NOTHREADS
+		opamutexLock(&a->m);
+	#else
+		UNUSED(a);
+	#endif
+}
+
+static void opacarenaUnlock(opacarena* a) {
+	#ifndef OPA_NOTHREADS
+		opamutexUnlock(&a->m);
+	#else
+		UNUSED(a);
+	#endif
+}
+
+static void opacarenaDestroy(opacarena* a) {
+	#ifndef OPA_NOTHREADS
+		opamutexDestroy(&a->m);
+	#endif
+	OPAFREE(a);
+}
+
+static void opacarenaSlabRelease(opacarenaSlab* s) {
+	if (ATOMIC_DEC(&s->refs) != 0) {
+		return;
+	}
+	opacarena* a = s->arena;
+	int destroy = 0;
+	opacarenaLock(a);
+	if (!a->closed && a->numFree < OPAC_ARENA_MAXFREE) {
+		s->next = a->freeList;
+		a->freeList = s;
+		++a->numFree;
+		s = NULL;
+	} else {
+		--a->numSlabs;
+		destroy = a->closed && a->numSlabs == 0;
+	}
+	opacarenaUnlock(a);
+	OPAFREE(s);
+	if (destroy) {
+		opacarenaDestroy(a);
+	}
+}
+
+static opacarenaSlab* opacarenaNextSlab(opacarena* a) {
+	opacarenaLock(a);
+	opacarenaSlab* s = a->freeList;
+	if (s != NULL) {
+		a->freeList = s->next;
+		--a->numFree;
+	} else {
+		s = OPAMALLOC(OPAC_ARENA_SLABLEN);
+		if (s != NULL) {
+			++a->numSlabs;
+		}
+	}
+	opacarenaUnlock(a);
+	if (s != NULL) {
+		s->next = NULL;
+		s->arena = a;
+		s->refs = 1;
+	}
+	return s;
+}
+
+uint8_t* opacarenaAlloc(opacarena* a, size_t len) {
+	SASSERT(sizeof(opacarenaSlab*) <= OPAC_ARENA_HDRLEN);
+	SASSERT(OPAC_ARENA_SLABHDRLEN + OPAC_ARENA_HDRLEN + OPAC_ARENA_MAXALLOC <= OPAC_ARENA_SLABLEN);
+	if (len > OPAC_ARENA_MAXALLOC) {
+		return NULL;
+	}
+	size_t need = OPAC_ARENA_HDRLEN + OPAC_ARENA_ALIGN(len);
+	if (a->cur == NULL || a->curPos + need > OPAC_ARENA_SLABLEN) {
+		if (a->cur != NULL) {
+			opacarenaSlab* prev = a->cur;
+			a->cur = NULL;
+			opacarenaSlabRelease(prev);
+		}
+		a->cur = opacarenaNextSlab(a);
+		if (a->cur == NULL) {
+			return NULL;
+		}
+		a->curPos = OPAC_ARENA_SLABHDRLEN;
+	}
+	uint8_t* p = ((uint8_t*) a->cur) + a->curPos;
+	*((opacarenaSlab**) p) = a->cur;
+	ATOMIC_INC(&a->cur->refs);
+	a->curPos += need;
+	return p + OPAC_ARENA_HDRLEN;
+}
+
+void opacarenaFree(const uint8_t* p) {
+	if (p != NULL) {
+		opacarenaSlabRelease(*((opacarenaSlab* const*) (p - OPAC_ARENA_HDRLEN)));
+	}
+}
+
+opacarena* opacarenaNew(void) {
+	opacarena* a = OPAMALLOC(sizeof(opacarena));
+	if (a != NULL) {
+		memset(a, 0, sizeof(opacarena));
+		#ifndef OPA_NOTHREADS
+			opamutexInit(&a->m);
+		#endif
+	}
+	return a;
+}
+
+void opacarenaClose(opacarena* a) {
+	opacarenaLock(a);
+	a->closed = 1;
+	while (a->freeList != NULL) {
+		opacarenaSlab* s = a->freeList;
+		a->freeList = s->next;
+		OPAFREE(s);
+		--a->numSlabs;
+	}
+	a->numFree = 0;
+	opacarenaSlab* cur = a->cur;
+	a->cur = NULL;
+	int destroy = cur == NULL && a->numSlabs == 0;
+	opacarenaUnlock(a);
+	if (cur != NULL) {
+		// note: arena is destroyed when the last slab is released
+		opacarenaSlabRelease(cur);
+	} else if (destroy) {
+		opacarenaDestroy(a);
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPACARENA_H_
+#define OPACARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef OPA_NOTHREADS
+#include "opamutex.h"
+#endif
+
+// size of each slab that responses are carved from
+#ifndef OPAC_ARENA_SLABLEN
+#define OPAC_ARENA_SLABLEN (1024 * 64)
+#endif
+
+// responses larger than this are not allocated from the arena
+#ifndef OPAC_ARENA_MAXALLOC
+#define OPAC_ARENA_MAXALLOC (1024 * 4)
+#endif
+
+// max number of released slabs kept for reuse
+#ifndef OPAC_ARENA_MAXFREE
+#define OPAC_ARENA_MAXFREE 16
+#endif
+
+typedef struct opacarenaSlab_s opacarenaSlab;
+
+typedef struct opacarena_s {
+#ifndef OPA_NOTHREADS
+	opamutex m;         // guards freeList, numFree, numSlabs, closed
+#endif
+	opacarenaSlab* cur; // slab that allocations are made from; only accessed by the parsing thread
+	size_t curPos;
+	opacarenaSlab* freeList;
+	unsigned int numFree;
+	size_t numSlabs;    // slabs that have been allocated and not freed (including cur and freeList)
+	char closed;
+} opacarena;
+
+/**
+ * Allocate a new arena. Allocations are bump allocated from the current slab; each allocation holds a
+ * reference to its slab and the slab is recycled when all of its allocations are freed. The arena is
+ * freed when it is closed and all allocations have been freed.
+ * @return NULL if out of memory
+ */
+opacarena* opacarenaNew(void);
+
+/**
+ * Allocate len bytes. Must only be called by 1 thread at a time.
+ * @return NULL if len is larger than OPAC_ARENA_MAXALLOC or out of memory
+ */
+uint8_t* opacarenaAlloc(opacarena* a, size_t len);
+
+/**
+ * Free memory returned by opacarenaAlloc(). Can be called from any thread. Does nothing if p is NULL
+ */
+void opacarenaFree(const uint8_t* p);
+
+/**
+ * Stop allocating from the arena. Memory is released as the remaining allocations are freed
+ */
+void opacarenaClose(opacarena* a);
+
+#endif
@@ -6,17 +6,22 @@
 #ifndef OPACIDMAP_H_
 #define OPACIDMAP_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef OPA_NOTHREADS
 #include "opamutex.h"
 #endif
 
+typedef int64_t opacid;
+
+// define OPACIDMAP_USE_RBT to store ids in a red-black tree rather than a hash table
+#ifdef OPACIDMAP_USE_RBT
+
 #include "rbt.h"
 
 typedef struct rbt_node RBTreeNode;
 typedef struct rbt RBTree;
-typedef int64_t opacid;
 
 typedef struct {
 	RBTreeNode node;
@@ -31,10 +36,35 @@ typedef struct {
 	RBTree t;
 } opacidmap;
 
+#else
+
+typedef struct {
+	opacid id;
+} opacidmapItem;
+
+typedef struct {
+	opacid id;
+	opacidmapItem* item; // NULL if slot is empty
+} opacidmapSlot;
+
+typedef struct {
+#ifndef OPA_NOTHREADS
+	opamutex m;
+	char sync;
+#endif
+	opacidmapSlot* slots; // open addressing with linear probing; slot index is a multiplicative hash of id
+	size_t mask;          // number of slots - 1 (0 if slots is NULL)
+	unsigned int shift;   // 64 - log2(number of slots); hash is shifted right by this
+	size_t count;
+} opacidmap;
+
+#endif
+
 void opacidmapInit(opacidmap* m);
 #ifndef OPA_NOTHREADS
 void opacidmapInitMT(opacidmap* m);
 #endif
+// return 1 if added to map; 0 if not added because id already exists in map; else error code
 int opacidmapAdd(opacidmap* m, opacidmapItem* i);
 opacidmapItem* opacidmapGet(opacidmap* m, opacid key, int remove);
 void opacidmapIterate(opacidmap* m, void* context, void (*cb)(void* context, const opacidmapItem* i));
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include "opacidmap.h"
+
+#ifndef OPACIDMAP_USE_RBT
+
+#include <string.h>
+
+#include "opacore.h"
+
+// number of slots allocated when the first item is added (must be a power of 2)
+#ifndef OPACIDMAP_MINSLOTS
+#define OPACIDMAP_MINSLOTS 64
+#endif
+
+// fibonacci hashing: the top bits of id * 2^64/phi. ids from opacGetAsyncId() are sequential and persistent
+//  ids count down from -1; the multiply spreads both evenly over the slots (masking the low bits would put
+//  ids that differ by a multiple of the slot count, ie from a caller's own id scheme, in the same slot)
+#define OPACIDMAP_SLOT(m, id) ((size_t) (((uint64_t) (id) * 0x9E3779B97F4A7C15ull) >> (m)->shift))
+
+
+static void opacidmapLock(opacidmap* m) {
+	#ifndef OPA_NOTHREADS
+		if (m->sync) {
+			opamutexLock(&m->m);
+		}
+	#else
+		UNUSED(m);
+	#endif
+}
+
+static void opacidmapUnlock(opacidmap* m) {
+	#ifndef OPA_NOTHREADS
+		if (m->sync) {
+			opamutexUnlock(&m->m);
+		}
+	#else
+		UNUSED(m);
+	#endif
+}
+
+void opacidmapInit(opacidmap* m) {
+	m->slots = NULL;
+	m->mask = 0;
+	m->shift = 64;
+	m->count = 0;
+	#ifndef OPA_NOTHREADS
+		m->sync = 0;
+	#endif
+}
+
+#ifndef OPA_NOTHREADS
+void opacidmapInitMT(opacidmap* m) {
+	opacidmapInit(m);
+	opamutexInit(&m->m);
+	m->sync = 1;
+}
+#endif
+
+void opacidmapClose(opacidmap* m) {
+	#ifndef OPA_NOTHREADS
+		if (m->sync) {
+			opamutexDestroy(&m->m);
+		}
+	#endif
+	OPAFREE(m->slots);
+	m->slots = NULL;
+	m->mask = 0;
+	m->count = 0;
+}
+
+static void opacidmapInsert(opacidmap* m, opacid id, opacidmapItem* item) {
+	size_t i = OPACIDMAP_SLOT(m, id);
+	while (m->slots[i].item != NULL) {
+		i = (i + 1) & m->mask;
+	}
+	m->slots[i].id = id;
+	m->slots[i].item = item;
+}
+
+static int opacidmapResize(opacidmap* m, size_t numSlots) {
+	opacidmapSlot* prev = m->slots;
+	size_t prevNum = prev == NULL ? 0 : m->mask + 1;
+	opacidmapSlot* slots = OPAMALLOC(numSlots * sizeof(opacidmapSlot));
+	if (slots == NULL) {
+		return OPA_ERR_NOMEM;
+	}
+	memset(slots, 0, numSlots * sizeof(opacidmapSlot));
+	m->slots = slots;
+	m->mask = numSlots - 1;
+	m->shift = 64;
+	for (size_t n = numSlots; n > 1; n >>= 1) {
+		--m->shift;
+	}
+	for (size_t i = 0; i < prevNum; ++i) {
+		if (prev[i].item != NULL) {
+			opacidmapInsert(m, prev[i].id, prev[i].item);
+		}
+	}
+	OPAFREE(prev);
+	return 0;
+}
+
+// return index of slot that contains id; or index of empty slot where id would be added
+static size_t opacidmapFind(const opacidmap* m, opacid id) {
+	size_t i = OPACIDMAP_SLOT(m, id);
+	while (m->slots[i].item != NULL && m->slots[i].id != id) {
+		i = (i + 1) & m->mask;
+	}
+	return i;
+}
+
+// empty slot i and shift following items back so that lookups do not need tombstones
+static void opacidmapRemoveAt(opacidmap* m, size_t i) {
+	size_t j = i;
+	while (1) {
+		j = (j + 1) & m->mask;
+		if (m->slots[j].item == NULL) {
+			break;
+		}
+		size_t home = OPACIDMAP_SLOT(m, m->slots[j].id);
+		// item at j can stay if its home slot is cyclically within (i, j]
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+			continue;
+		}
+		m->slots[i] = m->slots[j];
+		i = j;
+	}
+	m->slots[i].item = NULL;
+	--m->count;
+}
+
+int opacidmapAdd(opacidmap* m, opacidmapItem* i) {
+	opacidmapLock(m);
+	// keep load factor at or below 1/2 so that probe sequences stay short
+	int res = 0;
+	if (m->slots == NULL || (m->count + 1) * 2 > m->mask + 1) {
+		res = opacidmapResize(m, m->slots == NULL ? OPACIDMAP_MINSLOTS : (m->mask + 1) * 2);
+	}
+	if (!res) {
+		res = 1;
+		size_t idx = opacidmapFind(m, i->id);
+		if (m->slots[idx].item != NULL) {
+			res = 0;
+		} else {
+			m->slots[idx].id = i->id;
+			m->slots[idx].item = i;
+			++m->count;
+		}
+	}
+	opacidmapUnlock(m);
+	return res;
+}
+
+opacidmapItem* opacidmapGet(opacidmap* m, opacid key, int remove) {
+	opacidmapItem* item = NULL;
+	opacidmapLock(m);
+	if (m->slots != NULL) {
+		size_t idx = opacidmapFind(m, key);
+		item = m->slots[idx].item;
+		if (item != NULL && remove) {
+			opacidmapRemoveAt(m, idx);
+			if (m->mask + 1 > OPACIDMAP_MINSLOTS && m->count * 8 < m->mask + 1) {
+				// shrink after a burst; ignore error because the current table is still valid
+				opacidmapResize(m, (m->mask + 1) / 2);
+			}
+		}
+	}
+	opacidmapUnlock(m);
+	return item;
+}
+
+void opacidmapIterate(opacidmap* m, void* context, void (*cb)(void* context, const opacidmapItem* i)) {
+	opacidmapLock(m);
+	if (m->slots != NULL) {
+		// note: the table is not modified here so items can be freed in callback
+		for (size_t i = 0; i <= m->mask; ++i) {
+			if (m->slots[i].item != NULL) {
+				cb(context, m->slots[i].item);
+			}
+		}
+	}
+	opacidmapUnlock(m);
+}
+
+#endif
@@ -3,9 +3,12 @@
  * Open sourced with ISC license. Refer to LICENSE for details.
  */
 
+#include "opacidmap.h"
+
+#ifdef OPACIDMAP_USE_RBT
+
 #include <stddef.h>
 
-#include "opacidmap.h"
 #include "opacore.h"
 #include "rbt_iter.h"
 
@@ -31,7 +34,7 @@ static void opacidmapLock(opacidmap* m) {
 static void opacidmapUnlock(opacidmap* m) {
 	#ifndef OPA_NOTHREADS
 		if (m->sync) {
-			opamutexLock(&m->m);
+			opamutexUnlock(&m->m);
 		}
 	#else
 		UNUSED(m);
@@ -100,3 +103,5 @@ void opacidmapIterate(opacidmap* m, void* context, void (*cb)(void* context, con
 	}
 	opacidmapUnlock(m);
 }
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "opaclat.h"
+#include "opacore.h"
+
+
+static void opaclatLock(opaclat* l) {
+	#ifndef OPA_NOTHREADS
+		if (l->sync) {
+			opamutexLock(&l->m);
+		}
+	#else
+		UNUSED(l);
+	#endif
+}
+
+static void opaclatUnlock(opaclat* l) {
+	#ifndef OPA_NOTHREADS
+		if (l->sync) {
+			opamutexUnlock(&l->m);
+		}
+	#else
+		UNUSED(l);
+	#endif
+}
+
+static void opaclatInitLatency(opacLatency* lat) {
+	opahistInit(&lat->queue);
+	opahistInit(&lat->wire);
+	opahistInit(&lat->total);
+}
+
+opaclat* opaclatNew(int sync) {
+	opaclat* l = OPAMALLOC(sizeof(opaclat));
+	if (l != NULL) {
+		memset(l, 0, sizeof(opaclat));
+		opaclatInitLatency(&l->all);
+		#ifndef OPA_NOTHREADS
+			if (sync) {
+				opamutexInit(&l->m);
+				l->sync = 1;
+			}
+		#else
+			UNUSED(sync);
+		#endif
+	}
+	return l;
+}
+
+void opaclatFree(opaclat* l) {
+	if (l == NULL) {
+		return;
+	}
+	#ifndef OPA_NOTHREADS
+		if (l->sync) {
+			opamutexDestroy(&l->m);
+		}
+	#endif
+	for (size_t i = 0; i < l->numCmds; ++i) {
+		OPAFREE(l->cmds[i]);
+	}
+	OPAFREE(l);
+}
+
+// must hold lock
+static opaclatCmd* opaclatFind(opaclat* l, const void* name, size_t nameLen) {
+	for (size_t i = 0; i < l->numCmds; ++i) {
+		opaclatCmd* cmd = l->cmds[i];
+		if (cmd->nameLen == nameLen && memcmp(cmd->name, name, nameLen) == 0) {
+			return cmd;
+		}
+	}
+	return NULL;
+}
+
+opaclatCmd* opaclatGetCmd(opaclat* l, const uint8_t* name, size_t nameLen) {
+	opaclatLock(l);
+	opaclatCmd* cmd = opaclatFind(l, name, nameLen);
+	if (cmd == NULL && l->numCmds < OPAC_LAT_MAXCMDS) {
+		cmd = OPAMALLOC(sizeof(opaclatCmd) + nameLen);
+		if (cmd != NULL) {
+			uint8_t* nameCopy = ((uint8_t*) cmd) + sizeof(opaclatCmd);
+			memcpy(nameCopy, name, nameLen);
+			opaclatInitLatency(&cmd->lat);
+			cmd->name = nameCopy;
+			cmd->nameLen = nameLen;
+			l->cmds[l->numCmds++] = cmd;
+		}
+	}
+	opaclatUnlock(l);
+	return cmd;
+}
+
+static void opaclatRecordLatency(opacLatency* lat, uint64_t queue, uint64_t wire, uint64_t total) {
+	opahistRecord(&lat->queue, queue);
+	opahistRecord(&lat->wire, wire);
+	opahistRecord(&lat->total, total);
+}
+
+void opaclatRecord(opaclat* l, const opacReqTimes* t, uint64_t now) {
+	// note: if there are separate send/recv threads then the response can be handled before the send thread
+	//  records the time that the request was fully written
+	uint64_t sent = t->sent != 0 && t->sent <= now ? t->sent : t->sendStart;
+	uint64_t queue = t->sendStart > t->queued ? t->sendStart - t->queued : 0;
+	uint64_t wire = now > sent ? now - sent : 0;
+	uint64_t total = now > t->queued ? now - t->queued : 0;
+	opaclatLock(l);
+	opaclatRecordLatency(&l->all, queue, wire, total);
+	if (t->cmd != NULL) {
+		opaclatRecordLatency(&t->cmd->lat, queue, wire, total);
+	}
+	opaclatUnlock(l);
+}
+
+int opaclatGet(opaclat* l, const char* name, size_t nameLen, opacLatency* lat) {
+	int err = 0;
+	opaclatLock(l);
+	if (name == NULL) {
+		*lat = l->all;
+	} else {
+		const opaclatCmd* cmd = opaclatFind(l, name, nameLen);
+		if (cmd != NULL) {
+			*lat = cmd->lat;
+		} else {
+			err = OPA_ERR_INVARG;
+		}
+	}
+	opaclatUnlock(l);
+	return err;
+}
+
+int opaclatGetName(opaclat* l, size_t idx, const char** pName, size_t* pLen) {
+	int err = 0;
+	opaclatLock(l);
+	if (idx < l->numCmds) {
+		*pName = (const char*) l->cmds[idx]->name;
+		*pLen = l->cmds[idx]->nameLen;
+	} else {
+		err = OPA_ERR_INVARG;
+	}
+	opaclatUnlock(l);
+	return err;
+}
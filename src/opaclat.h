@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPACLAT_H_
+#define OPACLAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "opahist.h"
+
+#ifndef OPA_NOTHREADS
+#include "opamutex.h"
+#endif
+
+// max number of commands that latency is recorded for separately; other commands are only included in the totals
+#ifndef OPAC_LAT_MAXCMDS
+#define OPAC_LAT_MAXCMDS 64
+#endif
+
+// all times are in nanoseconds
+typedef struct {
+	opahist queue; // from opacQueueRequest() until the request is taken from the queue to be written
+	opahist wire;  // from when the request is fully written until its response is received
+	opahist total; // from opacQueueRequest() until the response is received
+} opacLatency;
+
+typedef struct opaclatCmd_s {
+	opacLatency lat;
+	const uint8_t* name; // stored after the struct (same allocation)
+	size_t nameLen;
+} opaclatCmd;
+
+// timestamps (from opaTimeNanos) of a request; only set if latency is enabled
+typedef struct {
+	uint64_t queued;
+	uint64_t sendStart; // taken from the queue to be written
+	uint64_t sent;      // fully written
+	opaclatCmd* cmd;    // NULL if the command is not tracked separately
+} opacReqTimes;
+
+typedef struct opaclat_s {
+#ifndef OPA_NOTHREADS
+	opamutex m;
+	char sync;
+#endif
+	opacLatency all;
+	opaclatCmd* cmds[OPAC_LAT_MAXCMDS];
+	size_t numCmds;
+} opaclat;
+
+/**
+ * @param sync non-zero if the stats are accessed from multiple threads
+ * @return NULL if out of memory
+ */
+opaclat* opaclatNew(int sync);
+void opaclatFree(opaclat* l);
+
+/**
+ * Find the stats of a command; they are added if the command has not been seen before.
+ * @return NULL if OPAC_LAT_MAXCMDS commands already exist or out of memory
+ */
+opaclatCmd* opaclatGetCmd(opaclat* l, const uint8_t* name, size_t nameLen);
+
+/**
+ * Record the latency of a request whose response was received at time now
+ */
+void opaclatRecord(opaclat* l, const opacReqTimes* t, uint64_t now);
+
+/**
+ * Copy the stats of a command (or of all commands if name is NULL)
+ * @return 0 on success; OPA_ERR_INVARG if the command has not been seen
+ */
+int opaclatGet(opaclat* l, const char* name, size_t nameLen, opacLatency* lat);
+
+/**
+ * Get the name of the idx'th command that has stats. The name is valid until the stats are freed.
+ * @return 0 on success; OPA_ERR_INVARG if idx is out of range
+ */
+int opaclatGetName(opaclat* l, size_t idx, const char** pName, size_t* pLen);
+
+#endif
@@ -19,6 +19,8 @@
 	//#define funlockfile _unlock_file
 #else
 	#include <sys/time.h>
+	#include <time.h>
+	#include <unistd.h>
 #endif
 
 #include <limits.h>
@@ -29,6 +31,7 @@
 #include "winutils.h"
 
 #include "opacore.h"
+#include "opautf8.h"
 
 
 #ifdef _WIN32
@@ -143,6 +146,16 @@ uint64_t opaTimeMillis(void) {
 	return (((((uint64_t) t.dwHighDateTime) << 32) | ((uint64_t)t.dwLowDateTime)) - 116444736000000000ULL) / 10000ULL;
 }
 
+uint64_t opaTimeNanos(void) {
+	LARGE_INTEGER freq;
+	LARGE_INTEGER t;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	uint64_t f = (uint64_t) freq.QuadPart;
+	uint64_t v = (uint64_t) t.QuadPart;
+	return ((v / f) * 1000000000ULL) + (((v % f) * 1000000000ULL) / f);
+}
+
 static int isAscii(const char* s) {
 	for (; *s != 0; ++s) {
 		if (*s < 0) {
@@ -195,6 +208,15 @@ uint64_t opaTimeMillis(void) {
 	return (t.tv_sec * 1000) + (t.tv_usec / 1000);
 }
 
+uint64_t opaTimeNanos(void) {
+	struct timespec t;
+	if (clock_gettime(CLOCK_MONOTONIC, &t)) {
+		LOGSYSERRNO();
+		return 0;
+	}
+	return (((uint64_t) t.tv_sec) * 1000000000ULL) + (uint64_t) t.tv_nsec;
+}
+
 void opaszmem(void* s, size_t n) {
 	// TODO: is this correct?
 	// http://www.daemonology.net/blog/2014-09-04-how-to-zero-a-buffer.html
@@ -424,7 +446,56 @@ void opaZeroAndFree(void* ptr, size_t len) {
 	}
 }
 
-size_t opaviGetStoredLen(const uint8_t* buff) {
+// OPAVI_FASTLOAD: decode varints from a single unaligned 8 byte little-endian load. The load can read
+//  past the end of the varint (and the buffer), so it is only done when it does not cross a page boundary
+//  and it is disabled when building with AddressSanitizer (define OPAVI_NOFASTLOAD to disable it for
+//  other memory checkers, ie valgrind)
+#if !defined(OPAVI_NOFASTLOAD) && defined(__SANITIZE_ADDRESS__)
+#define OPAVI_NOFASTLOAD
+#endif
+#if !defined(OPAVI_NOFASTLOAD) && defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define OPAVI_NOFASTLOAD
+#endif
+#endif
+#if !defined(OPAVI_NOFASTLOAD) && defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && UINTPTR_MAX == UINT64_MAX
+#define OPAVI_FASTLOAD
+#endif
+
+#ifdef OPAVI_FASTLOAD
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#define OPAVI_PAGELEN 4096
+#define OPAVI_MSBS 0x8080808080808080ULL
+
+// load 8 bytes if that can be done without crossing into the next page
+static int opaviLoad8(const uint8_t* buff, uint64_t* pVal) {
+	if (((uintptr_t) buff & (OPAVI_PAGELEN - 1)) > OPAVI_PAGELEN - 8) {
+		return 0;
+	}
+	memcpy(pVal, buff, 8);
+	return 1;
+}
+
+// remove the continuation bits of the first len bytes of v (len <= 8); result is up to 56 bits
+static uint64_t opaviCompact(uint64_t v, unsigned int len) {
+	uint64_t keep = len >= 8 ? UINT64_MAX : (((uint64_t) 1) << (len * 8)) - 1;
+#ifdef __BMI2__
+	return _pext_u64(v, keep & ~OPAVI_MSBS);
+#else
+	v &= keep & ~OPAVI_MSBS;
+	v = ((v & 0x7F007F007F007F00ULL) >> 1) | (v & 0x007F007F007F007FULL);
+	v = ((v & 0x3FFF00003FFF0000ULL) >> 2) | (v & 0x00003FFF00003FFFULL);
+	return ((v & 0x0FFFFFFF00000000ULL) >> 4) | (v & 0x000000000FFFFFFFULL);
+#endif
+}
+
+#endif
+
+static size_t opaviGetStoredLenSlow(const uint8_t* buff) {
 	const uint8_t* start = buff;
 	while (*buff & 0x80) {
 		++buff;
@@ -432,7 +503,21 @@ size_t opaviGetStoredLen(const uint8_t* buff) {
 	return buff - start + 1;
 }
 
-int opaviLoadWithErr(const uint8_t* buff, uint64_t* pVal, const uint8_t** pBuff) {
+size_t opaviGetStoredLen(const uint8_t* buff) {
+#ifdef OPAVI_FASTLOAD
+	uint64_t v;
+	if (opaviLoad8(buff, &v)) {
+		// a byte without the MSB set is the last byte of the varint
+		uint64_t stops = ~v & OPAVI_MSBS;
+		if (stops != 0) {
+			return (__builtin_ctzll(stops) >> 3) + 1;
+		}
+	}
+#endif
+	return opaviGetStoredLenSlow(buff);
+}
+
+static int opaviLoadSlow(const uint8_t* buff, uint64_t* pVal, const uint8_t** pBuff) {
 	uint64_t val = buff[0] & 0x7F;
 	int bitShift = 7;
 	while ((buff[0] & 0x80) && bitShift <= 63) {
@@ -453,6 +538,36 @@ int opaviLoadWithErr(const uint8_t* buff, uint64_t* pVal, const uint8_t** pBuff)
 	return 0;
 }
 
+int opaviLoadWithErr(const uint8_t* buff, uint64_t* pVal, const uint8_t** pBuff) {
+	if (!(buff[0] & 0x80)) {
+		*pVal = buff[0];
+		if (pBuff != NULL) {
+			*pBuff = buff + 1;
+		}
+		return 0;
+	}
+#ifdef OPAVI_FASTLOAD
+	uint64_t v;
+	if (opaviLoad8(buff, &v)) {
+		uint64_t stops = ~v & OPAVI_MSBS;
+		if (stops != 0) {
+			unsigned int len = (__builtin_ctzll(stops) >> 3) + 1;
+			if (((v >> ((len - 1) * 8)) & 0xFF) == 0) {
+				// invalid varint MSB
+				return OPA_ERR_INVARG;
+			}
+			*pVal = opaviCompact(v, len);
+			if (pBuff != NULL) {
+				*pBuff = buff + len;
+			}
+			return 0;
+		}
+		// 9 or 10 bytes: rare (values >= 2^56)
+	}
+#endif
+	return opaviLoadSlow(buff, pVal, pBuff);
+}
+
 uint64_t opaviLoad(const uint8_t* buff, const uint8_t** pBuff) {
 	uint64_t val;
 	int err = opaviLoadWithErr(buff, &val, pBuff);
@@ -463,23 +578,37 @@ uint64_t opaviLoad(const uint8_t* buff, const uint8_t** pBuff) {
 }
 
 uint8_t* opaviStore(uint64_t val, uint8_t* buff) {
-	while (val > 0x7F) {
+	// 1 and 2 byte varints (lengths and small numbers) are written without a loop. note: a switch on
+	//  opaviStoreLen() that writes every byte without a loop was slower when lengths are unpredictable
+	if (val <= 0x7F) {
+		*buff = (uint8_t) val;
+		return buff + 1;
+	} else if (val <= 0x3FFF) {
+		buff[0] = (uint8_t) val | 0x80;
+		buff[1] = (uint8_t) (val >> 7);
+		return buff + 2;
+	}
+	do {
 		*buff++ = 0x80 | (val & 0x7F);
 		val >>= 7;
-	}
-	*buff++ = val & 0x7F;
+	} while (val > 0x7F);
+	*buff++ = (uint8_t) val;
 	return buff;
 }
 
 uint8_t opaviStoreLen(uint64_t val) {
+#ifdef __GNUC__
+	// number of significant bits; 7 per byte
+	unsigned int bits = 64 - __builtin_clzll(val | 0x01);
+	return (uint8_t) ((bits + 6) / 7);
+#else
 	uint8_t len = 1;
 	while (val > 0x7F) {
 		++len;
 		val >>= 7;
 	}
 	return len;
-
-	//return 1 + (((64 - __builtin_clzll(val | 0x01)) - 1) / 7);
+#endif
 }
 
 static int isDigit(char c) {
@@ -561,37 +690,19 @@ int opaIsInfStr(const char* str, size_t len) {
 const uint8_t* opaFindInvalidUtf8(const uint8_t* s, size_t len) {
 	const uint8_t* end = s + len;
 
-	// TODO: look into other techniques to speed this up
-	//  https://github.com/lemire/fastvalidate-utf-8
-	//  https://github.com/cyb70289/utf8/
-	//  https://lemire.me/blog/2020/10/20/ridiculously-fast-unicode-utf-8-validation/
-
-	/*
-	#ifdef __SSE2__
-		// use SSE to skip ascii chars
-		if (len >= 16) {
-			const uint8_t* sseEnd = end - 16;
-			while (s < sseEnd) {
-				// skip in chunks of 16 bytes if MSB is not set (chars are ASCII)
-				int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) s));
-				if (mask != 0) {
-					// this chunk contains a non-ascii character
-					s += __builtin_ctz(mask);
-					break;
-				}
-				s += 16;
-			}
-		}
-	#endif
-	*/
-
 	// the following code is adapted from https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
 	//   Markus Kuhn <http://www.cl.cam.ac.uk/~mgk25/> -- 2005-03-30
 	//   License: http://www.cl.cam.ac.uk/~mgk25/short-license.html
 	while (s < end) {
-		if (*s < 0x80) {
+		// validate whole blocks with SIMD (or skip ascii chars); the rest is checked 1 char at a time
+		s += opautf8ValidPrefix(s, end - s);
+		while (s < end && *s < 0x80) {
 			s++;
-		} else if ((s[0] & 0xe0) == 0xc0 && s + 1 < end) {
+		}
+		if (s >= end) {
+			break;
+		}
+		if ((s[0] & 0xe0) == 0xc0 && s + 1 < end) {
 			// 110XXXXx 10xxxxxx
 			if ((s[1] & 0xc0) != 0x80 || (s[0] & 0xfe) == 0xc0) {
 				return s;
@@ -696,6 +807,30 @@ void opacorePrintLowerLUT() {
 }
 */
 
+// read up to len bytes of a file at offset without changing the file position
+int opacoreReadAt(int fd, uint64_t offset, void* buff, size_t len, size_t* pNumRead) {
+	#ifndef _WIN32
+		while (1) {
+			ssize_t res = pread(fd, buff, len, (off_t) offset);
+			if (res > 0) {
+				*pNumRead = res;
+				return 0;
+			} else if (res == 0) {
+				return OPA_ERR_EOF;
+			} else if (errno != EINTR) {
+				return OPA_ERR_INTERNAL;
+			}
+		}
+	#else
+		UNUSED(fd);
+		UNUSED(offset);
+		UNUSED(buff);
+		UNUSED(len);
+		UNUSED(pNumRead);
+		return OPA_ERR_UNSUPPORTED;
+	#endif
+}
+
 // read a file into a null terminated string buffer
 int opacoreReadFile(const char* path, uint8_t** pBuff, size_t* pLen) {
 	uint8_t* buff = NULL;
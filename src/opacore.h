@@ -201,6 +201,8 @@ void opaszmem(void* ptr, size_t len);
 
 void opaZeroAndFree(void* ptr, size_t len);
 uint64_t opaTimeMillis(void);
+// nanoseconds from a monotonic clock with an unspecified starting point (only useful to measure intervals)
+uint64_t opaTimeNanos(void);
 
 
 #define OPAVI_MAXLEN64 10
@@ -222,6 +224,7 @@ int opaStrCmpNoCaseAscii(const char* s1, const char* s2);
 int opaStrCmpNoCaseAsciiLen(const void* s1, size_t l1, const void* s2, size_t l2);
 
 int opacoreReadFile(const char* path, uint8_t** pBuff, size_t* pLen);
+int opacoreReadAt(int fd, uint64_t offset, void* buff, size_t len, size_t* pNumRead);
 
 
 #endif
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "opacore.h"
+#include "opacpool.h"
+
+#ifdef OPA_NOTHREADS
+#define ATOMIC_INC64(v) (++(*(v)))
+#define ATOMIC_ADD64(v, n) ((*(v)) += (n))
+#define ATOMIC_LOAD64(v) (*(v))
+#else
+#ifdef _MSC_VER
+#define ATOMIC_INC64(v) InterlockedIncrement64((volatile LONG64*) (v))
+#define ATOMIC_ADD64(v, n) InterlockedExchangeAdd64((volatile LONG64*) (v), (n))
+#define ATOMIC_LOAD64(v) (*(volatile uint64_t*) (v))
+#elif defined(__GNUC__)
+#define ATOMIC_INC64(v) __sync_add_and_fetch((v), 1)
+#define ATOMIC_ADD64(v, n) __sync_add_and_fetch((v), (n))
+#define ATOMIC_LOAD64(v) __atomic_load_n((v), __ATOMIC_RELAXED)
+#endif
+#endif
+
+
+opacpoolConn* opacpoolConnFromClient(opac* c) {
+	return list_entry(c, opacpoolConn, c);
+}
+
+opacpoolConn* opacpoolGetConn(opacpool* p, unsigned int idx) {
+	return idx < p->numConns ? &p->conns[idx] : NULL;
+}
+
+// return the asyncid type (2nd byte) of a serialized request or response
+static uint8_t opacpoolIdType(const opacReq* r) {
+	return opabuffGetLen(&r->rrbuff) > 1 ? *opabuffGetPos(&r->rrbuff, 1) : 0;
+}
+
+static void opacpoolDone(opacpoolConn* pc) {
+	ATOMIC_ADD64(&pc->outstanding, (uint64_t) -1);
+	ATOMIC_ADD64(&pc->numDone, 1);
+}
+
+static void opacpoolOnSent(opac* c, opacReq* r) {
+	opacpoolConn* pc = opacpoolConnFromClient(c);
+	ATOMIC_ADD64(&pc->unsentBytes, 0 - (uint64_t) opabuffGetLen(&r->rrbuff));
+	if (opacpoolIdType(r) == OPADEF_FALSE) {
+		// no response will be received
+		opacpoolDone(pc);
+	}
+	if (pc->pool->userFuncs->onSent != NULL) {
+		pc->pool->userFuncs->onSent(c, r);
+	} else {
+		opacReqFreeRequest(r);
+	}
+}
+
+static void opacpoolOnResponse(opac* c, opacReq* r) {
+	opacpoolConn* pc = opacpoolConnFromClient(c);
+	// note: persistent requests remain outstanding until removed or the client is closed
+	if (opacpoolIdType(r) != OPADEF_NEGVARINT) {
+		opacpoolDone(pc);
+	}
+	if (pc->pool->userFuncs->onResponse != NULL) {
+		pc->pool->userFuncs->onResponse(c, r);
+	}
+}
+
+static void opacpoolReqErr(opac* c, opacReq* r, opacReqErrReason reason, int errCode) {
+	opacpoolConn* pc = opacpoolConnFromClient(c);
+	if (!opacReqIsSent(r)) {
+		ATOMIC_ADD64(&pc->unsentBytes, 0 - (uint64_t) opabuffGetLen(&r->rrbuff));
+	}
+	ATOMIC_ADD64(&pc->outstanding, (uint64_t) -1);
+	ATOMIC_ADD64(&pc->numErrs, 1);
+	if (pc->pool->userFuncs->reqErr != NULL) {
+		pc->pool->userFuncs->reqErr(c, r, reason, errCode);
+	} else {
+		opacReqFreeRequest(r);
+		r->pos = NULL;
+	}
+}
+
+static opacpoolConn* opacpoolPick(opacpool* p) {
+	opacpoolConn* best = NULL;
+	uint64_t bestReqs = 0;
+	uint64_t bestBytes = 0;
+	for (unsigned int i = 0; i < p->numConns; ++i) {
+		opacpoolConn* pc = &p->conns[i];
+		if (!opacIsOpen(&pc->c)) {
+			continue;
+		}
+		uint64_t reqs = ATOMIC_LOAD64(&pc->outstanding);
+		uint64_t bytes = ATOMIC_LOAD64(&pc->unsentBytes);
+		if (best == NULL || reqs < bestReqs || (reqs == bestReqs && bytes < bestBytes)) {
+			best = pc;
+			bestReqs = reqs;
+			bestBytes = bytes;
+			if (reqs == 0 && bytes == 0) {
+				break;
+			}
+		}
+	}
+	// if all clients are closed then the request is rejected by the first client
+	return best != NULL ? best : &p->conns[0];
+}
+
+opacpoolConn* opacpoolQueueRequest(opacpool* p, opacReq* r, int* pEmpty) {
+	opacpoolConn* pc = opacpoolPick(p);
+	// note: counters are incremented first because callbacks can be invoked before opacQueueRequest returns
+	ATOMIC_ADD64(&pc->outstanding, 1);
+	ATOMIC_ADD64(&pc->unsentBytes, opabuffGetLen(&r->rrbuff));
+	ATOMIC_ADD64(&pc->numQueued, 1);
+	int empty = opacQueueRequest(&pc->c, r);
+	if (pEmpty != NULL) {
+		*pEmpty = empty;
+	}
+	return pc;
+}
+
+int opacpoolRemovePersistent(opacpool* p, opacReqAsync* r) {
+	for (unsigned int i = 0; i < p->numConns; ++i) {
+		if (opacRemovePersistent(&p->conns[i].c, r)) {
+			ATOMIC_ADD64(&p->conns[i].outstanding, (uint64_t) -1);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+size_t opacpoolCheckTimeouts(opacpool* p, uint64_t now) {
+	size_t count = 0;
+	for (unsigned int i = 0; i < p->numConns; ++i) {
+		count += opacCheckTimeouts(&p->conns[i].c, now);
+	}
+	return count;
+}
+
+opacid opacpoolGetAsyncId(opacpool* p, int persistent) {
+	uint64_t id = ATOMIC_INC64(&p->currId);
+	return persistent ? 0 - id : id;
+}
+
+void opacpoolGetStats(opacpool* p, opacpoolStats* stats) {
+	memset(stats, 0, sizeof(opacpoolStats));
+	stats->numConns = p->numConns;
+	for (unsigned int i = 0; i < p->numConns; ++i) {
+		opacpoolConn* pc = &p->conns[i];
+		if (opacIsOpen(&pc->c)) {
+			++stats->numOpen;
+		}
+		stats->outstanding += ATOMIC_LOAD64(&pc->outstanding);
+		stats->unsentBytes += ATOMIC_LOAD64(&pc->unsentBytes);
+		stats->numQueued += ATOMIC_LOAD64(&pc->numQueued);
+		stats->numDone += ATOMIC_LOAD64(&pc->numDone);
+		stats->numErrs += ATOMIC_LOAD64(&pc->numErrs);
+	}
+}
+
+int opacpoolInit(opacpool* p, unsigned int numConns, const opacFuncs* funcs, int mt) {
+	memset(p, 0, sizeof(opacpool));
+	if (numConns == 0) {
+		return OPA_ERR_INVARG;
+	}
+	p->conns = OPAMALLOC(numConns * sizeof(opacpoolConn));
+	if (p->conns == NULL) {
+		return OPA_ERR_NOMEM;
+	}
+	memset(p->conns, 0, numConns * sizeof(opacpoolConn));
+	p->numConns = numConns;
+	p->userFuncs = funcs;
+	p->funcs = *funcs;
+	p->funcs.onSent = opacpoolOnSent;
+	p->funcs.onResponse = opacpoolOnResponse;
+	p->funcs.reqErr = opacpoolReqErr;
+	for (unsigned int i = 0; i < numConns; ++i) {
+		opacpoolConn* pc = &p->conns[i];
+		pc->pool = p;
+#ifndef OPA_NOTHREADS
+		if (mt) {
+			opacInitMT(&pc->c, &p->funcs);
+		} else {
+			opacInit(&pc->c, &p->funcs);
+		}
+#else
+		UNUSED(mt);
+		opacInit(&pc->c, &p->funcs);
+#endif
+	}
+	return 0;
+}
+
+void opacpoolClose(opacpool* p) {
+	for (unsigned int i = 0; i < p->numConns; ++i) {
+		opacClose(&p->conns[i].c);
+	}
+	OPAFREE(p->conns);
+	p->conns = NULL;
+	p->numConns = 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPACPOOL_H_
+#define OPACPOOL_H_
+
+#include "opac.h"
+
+typedef struct opacpool_s opacpool;
+
+typedef struct {
+	opac c;
+	opacpool* pool;
+	uint64_t outstanding;  // requests queued that are waiting to be sent or waiting for a response
+	uint64_t unsentBytes;  // bytes of queued requests that have not been written yet
+	uint64_t numQueued;
+	uint64_t numDone;      // responses received plus no-response requests written
+	uint64_t numErrs;      // requests passed to reqErr
+	void* udata;           // for the user (ie, socket that belongs to this connection)
+} opacpoolConn;
+
+struct opacpool_s {
+	opacpoolConn* conns;
+	unsigned int numConns;
+	opacFuncs funcs;          // callbacks given to each client (wrap the user's callbacks to track load)
+	const opacFuncs* userFuncs;
+	uint64_t currId;
+};
+
+typedef struct {
+	unsigned int numConns;
+	unsigned int numOpen;
+	uint64_t outstanding;
+	uint64_t unsentBytes;
+	uint64_t numQueued;
+	uint64_t numDone;
+	uint64_t numErrs;
+} opacpoolStats;
+
+/**
+ * Initialize a pool of clients that are connected to the same server. Requests are routed to the
+ * client with the fewest outstanding requests (ties are broken by unsent bytes) so that load is
+ * spread across connections and each client's queues and locks are shared by fewer threads.
+ * Each client must be driven like a normal client (opacSendRequests/opacParseResponses on its
+ * connection); use opacpoolGetConn() to get each client and set udata to its connection.
+ * @param p Pool
+ * @param numConns Number of clients
+ * @param funcs Callbacks used by every client. The opac passed to the callbacks can be converted
+ *   with opacpoolConnFromClient()
+ * @param mt non-zero to initialize each client with opacInitMT()
+ * @return 0 on success; else error code
+ */
+int opacpoolInit(opacpool* p, unsigned int numConns, const opacFuncs* funcs, int mt);
+
+/**
+ * Close every client (see opacClose()) and free the pool's memory
+ */
+void opacpoolClose(opacpool* p);
+
+opacpoolConn* opacpoolGetConn(opacpool* p, unsigned int idx);
+
+opacpoolConn* opacpoolConnFromClient(opac* c);
+
+/**
+ * Get an async id that is unique across all clients in the pool
+ * @param persistent 0 if request will have exactly 1 response; else 1
+ */
+opacid opacpoolGetAsyncId(opacpool* p, int persistent);
+
+/**
+ * Queue a request on the least loaded open client. Async requests must use an id from opacpoolGetAsyncId()
+ * @return the connection that the request was queued on. Its writer may need to be woken up if the
+ *   connection's send queue was empty (see pEmpty)
+ * @param pEmpty if not null, set to the return value of opacQueueRequest()
+ */
+opacpoolConn* opacpoolQueueRequest(opacpool* p, opacReq* r, int* pEmpty);
+
+/**
+ * Remove a persistent request from whichever client it was queued on
+ * @return non-zero if the request was found and removed
+ */
+int opacpoolRemovePersistent(opacpool* p, opacReqAsync* r);
+
+/**
+ * Call opacCheckTimeouts() for every client in the pool
+ * @return number of requests that expired
+ */
+size_t opacpoolCheckTimeouts(opacpool* p, uint64_t now);
+
+/**
+ * Sum the load and counters of all clients. Values are read without locking so they may be
+ * slightly out of date when used from multiple threads.
+ */
+void opacpoolGetStats(opacpool* p, opacpoolStats* stats);
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPACPROBES_H_
+#define OPACPROBES_H_
+
+// USDT probes (provider "opac") for tracing a live process with bpftrace, perf, systemtap, etc. define
+//  OPAC_USDT to build them (requires sys/sdt.h, ie: sudo apt-get install systemtap-sdt-dev). a probe is a
+//  nop instruction until a tracer attaches to it. when OPAC_USDT is not defined the probes are compiled out
+//  and their arguments are not evaluated
+//
+// probes (a double underscore in the name is a dash in the tracer, ie usdt:./app:opac:request-queue):
+//   request__queue(opac* c, opacReq* r)                   request was added to the send queue
+//   send__start(opac* c, opacReq* r)                      request was taken from the queue to be written
+//   send__done(opac* c, opacReq* r)                       request was fully written
+//   response__end(opac* c, size_t len)                    parser found the end of a response of len bytes
+//   response__dispatch(opac* c, opacReq* r, int isErr)    response is passed to onResponse or the completion queue
+//   client__error(opac* c, int err)                       client encountered an error and cannot continue
+
+#ifdef OPAC_USDT
+
+#include <sys/sdt.h>
+
+#define OPAC_PROBE1(name, a)       DTRACE_PROBE1(opac, name, a)
+#define OPAC_PROBE2(name, a, b)    DTRACE_PROBE2(opac, name, a, b)
+#define OPAC_PROBE3(name, a, b, c) DTRACE_PROBE3(opac, name, a, b, c)
+
+#else
+
+#define OPAC_PROBE1(name, a)       ((void) 0)
+#define OPAC_PROBE2(name, a, b)    ((void) 0)
+#define OPAC_PROBE3(name, a, b, c) ((void) 0)
+
+#endif
+
+#endif
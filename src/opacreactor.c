@@ -0,0 +1,746 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE // SOCK_NONBLOCK SOCK_CLOEXEC MSG_NOSIGNAL
+#endif
+
+#include "opacore.h"
+#include "opacreactor.h"
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef OPAC_REACTOR_MAXEVENTS
+#define OPAC_REACTOR_MAXEVENTS 256
+#endif
+
+// number of bytes that a connection can read per event before other connections get a turn
+#ifndef OPAC_REACTOR_READBUDGET
+#define OPAC_REACTOR_READBUDGET (1024 * 256)
+#endif
+
+#ifndef OPAC_REACTOR_READLEN
+#define OPAC_REACTOR_READLEN (1024 * 64)
+#endif
+
+// max number of MSG_ZEROCOPY sends that can be in flight per connection (must be a multiple of 64)
+#ifndef OPAC_REACTOR_ZCMAX
+#define OPAC_REACTOR_ZCMAX 1024
+#endif
+
+#define OPAC_REACTOR_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLET)
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define OPAC_REACTOR_HAVEZC
+#endif
+
+typedef struct {
+	opabuff b;
+	uint32_t seq; // buffer can be freed when all zerocopy sends up to (and including) this one are complete
+} opacreactorZcBuff;
+
+struct opacreactorZc_s {
+	size_t minLen;          // sends of at least this many bytes use MSG_ZEROCOPY; 0 when disabled
+	uint32_t next;          // sequence number that the kernel will assign to the next zerocopy send
+	uint32_t done;          // all zerocopy sends before this sequence number have completed
+	uint64_t bits[OPAC_REACTOR_ZCMAX / 64]; // completions received out of order (indexed by seq % OPAC_REACTOR_ZCMAX)
+	opacreactorZcBuff* buffs; // ring of detached request buffers in the order they were written
+	size_t head;
+	size_t len;
+	size_t cap;
+	void (*onSent)(opac* c, opacReq* r); // user's callback
+};
+
+
+static opacreactorConn* opacreactorGetConn(opac* c) {
+	return list_entry(c, opacreactorConn, c);
+}
+
+static void opacreactorSockErr(opacreactorConn* conn, int err) {
+	if (conn->closeErr == 0) {
+		conn->sysErr = err;
+		conn->closeErr = OPA_ERR_INTERNAL;
+	}
+}
+
+static size_t opacreactorRead(opac* c, void* buff, size_t len) {
+	opacreactorConn* conn = opacreactorGetConn(c);
+	while (1) {
+		ssize_t res = recv(conn->fd, buff, len, 0);
+		if (res > 0) {
+			return res;
+		} else if (res == 0) {
+			if (conn->closeErr == 0) {
+				conn->closeErr = OPA_ERR_EOF;
+			}
+			return 0;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			conn->readBlocked = 1;
+			return 0;
+		} else if (errno != EINTR) {
+			opacreactorSockErr(conn, errno);
+			return 0;
+		}
+	}
+}
+
+static size_t opacreactorSendResult(opacreactorConn* conn, ssize_t res) {
+	if (res >= 0) {
+		return res;
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		opacreactorSockErr(conn, errno);
+	}
+	// note: an EPOLLOUT edge occurs when the socket becomes writable again
+	return 0;
+}
+
+static size_t opacreactorWrite(opac* c, const void* buff, size_t len) {
+	opacreactorConn* conn = opacreactorGetConn(c);
+	ssize_t res;
+	do {
+		res = send(conn->fd, buff, len, MSG_NOSIGNAL);
+	} while (res < 0 && errno == EINTR);
+	return opacreactorSendResult(conn, res);
+}
+
+#ifdef OPAC_REACTOR_HAVEZC
+// return non-zero if the bytes should be sent with MSG_ZEROCOPY
+static int opacreactorUseZc(opacreactorConn* conn, const opacIoVec* iov, int iovcnt) {
+	opacreactorZc* zc = conn->zc;
+	if (zc == NULL || zc->minLen == 0 || zc->next - zc->done >= OPAC_REACTOR_ZCMAX) {
+		return 0;
+	}
+	const uint8_t* staged = conn->c.streamBuff;
+	size_t len = 0;
+	for (int i = 0; i < iovcnt; ++i) {
+		const uint8_t* b = iov[i].buff;
+		if (staged != NULL && b >= staged && b < staged + conn->c.streamBuffLen) {
+			// request stream buffer is reused as soon as it is written
+			return 0;
+		}
+		len += iov[i].len;
+	}
+	return len >= zc->minLen;
+}
+#endif
+
+static size_t opacreactorWritev(opac* c, const opacIoVec* iov, int iovcnt) {
+	opacreactorConn* conn = opacreactorGetConn(c);
+	struct iovec sysiov[OPAC_WRITEVLEN];
+	if (iovcnt > OPAC_WRITEVLEN) {
+		iovcnt = OPAC_WRITEVLEN;
+	}
+	for (int i = 0; i < iovcnt; ++i) {
+		sysiov[i].iov_base = (void*) iov[i].buff;
+		sysiov[i].iov_len = iov[i].len;
+	}
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = sysiov;
+	msg.msg_iovlen = iovcnt;
+	int flags = MSG_NOSIGNAL;
+#ifdef OPAC_REACTOR_HAVEZC
+	if (opacreactorUseZc(conn, iov, iovcnt)) {
+		flags |= MSG_ZEROCOPY;
+	}
+#endif
+	ssize_t res;
+	while (1) {
+		res = sendmsg(conn->fd, &msg, flags);
+		if (res >= 0 || errno != EINTR) {
+			break;
+		}
+	}
+#ifdef OPAC_REACTOR_HAVEZC
+	if (flags & MSG_ZEROCOPY) {
+		if (res >= 0) {
+			++conn->zc->next;
+		} else if (errno == ENOBUFS) {
+			// notification memory (optmem) is used up; copy instead
+			do {
+				res = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+			} while (res < 0 && errno == EINTR);
+		}
+	}
+#endif
+	return opacreactorSendResult(conn, res);
+}
+
+// return non-zero if all zerocopy sends up to and including seq have completed
+static int opacreactorZcDone(const opacreactorZc* zc, uint32_t seq) {
+	return (int32_t) (zc->done - seq) > 0;
+}
+
+// free detached request buffers whose zerocopy sends have completed (or all buffers if all is non-zero)
+static void opacreactorZcRelease(opacreactorZc* zc, int all) {
+	while (zc->len > 0 && (all || opacreactorZcDone(zc, zc->buffs[zc->head].seq))) {
+		opabuffFree(&zc->buffs[zc->head].b);
+		zc->head = (zc->head + 1) % zc->cap;
+		--zc->len;
+	}
+}
+
+#ifdef OPAC_REACTOR_HAVEZC
+static void opacreactorZcComplete(opacreactorZc* zc, uint32_t lo, uint32_t hi) {
+	for (uint32_t seq = lo; (int32_t) (hi - seq) >= 0; ++seq) {
+		if (seq - zc->done < OPAC_REACTOR_ZCMAX) {
+			uint32_t i = seq % OPAC_REACTOR_ZCMAX;
+			zc->bits[i / 64] |= ((uint64_t) 1) << (i % 64);
+		}
+	}
+	while (1) {
+		uint32_t i = zc->done % OPAC_REACTOR_ZCMAX;
+		uint64_t bit = ((uint64_t) 1) << (i % 64);
+		if (zc->done == zc->next || !(zc->bits[i / 64] & bit)) {
+			break;
+		}
+		zc->bits[i / 64] &= ~bit;
+		++zc->done;
+	}
+}
+
+// read zerocopy completions from the socket's error queue
+static void opacreactorZcDrain(opacreactorConn* conn) {
+	opacreactorZc* zc = conn->zc;
+	while (1) {
+		union {
+			char buff[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+			struct cmsghdr align;
+		} ctrl;
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = ctrl.buff;
+		msg.msg_controllen = sizeof(ctrl.buff);
+		if (recvmsg(conn->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// EAGAIN: error queue is empty
+			break;
+		}
+		for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+				continue;
+			}
+			struct sock_extended_err ee;
+			memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+			if (ee.ee_errno != 0 || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+			opacreactorZcComplete(zc, ee.ee_info, ee.ee_data);
+			if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				// kernel copied the bytes anyway (ie, loopback or device without scatter-gather); stop paying for notifications
+				zc->minLen = 0;
+			}
+		}
+	}
+	opacreactorZcRelease(zc, 0);
+}
+
+static void opacreactorZcOnSent(opac* c, opacReq* r) {
+	opacreactorConn* conn = opacreactorGetConn(c);
+	opacreactorZc* zc = conn->zc;
+	if (zc->next != zc->done) {
+		// the kernel may still reference the request's bytes. note: the request's bytes were sent before or
+		//  with the latest zerocopy send so waiting for it is enough
+		if (zc->len == zc->cap) {
+			size_t cap = zc->cap == 0 ? 16 : zc->cap * 2;
+			opacreactorZcBuff* buffs = OPAMALLOC(cap * sizeof(opacreactorZcBuff));
+			if (buffs == NULL) {
+				// cannot free the buffer safely; leak it and close the connection
+				memset(&r->rrbuff, 0, sizeof(opabuff));
+				opacreactorSockErr(conn, ENOMEM);
+				goto Done;
+			}
+			for (size_t i = 0; i < zc->len; ++i) {
+				buffs[i] = zc->buffs[(zc->head + i) % zc->cap];
+			}
+			OPAFREE(zc->buffs);
+			zc->buffs = buffs;
+			zc->head = 0;
+			zc->cap = cap;
+		}
+		opacreactorZcBuff* zb = &zc->buffs[(zc->head + zc->len) % zc->cap];
+		zb->b = r->rrbuff;
+		zb->seq = zc->next - 1;
+		++zc->len;
+		memset(&r->rrbuff, 0, sizeof(opabuff));
+	}
+	Done:
+	if (zc->onSent != NULL) {
+		zc->onSent(c, r);
+	} else {
+		opacReqFreeRequest(r);
+	}
+}
+#endif
+
+int opacreactorEnableZeroCopy(opacreactorConn* conn, size_t minLen) {
+#ifdef OPAC_REACTOR_HAVEZC
+	if (conn->zc != NULL) {
+		conn->zc->minLen = minLen;
+		return 0;
+	}
+	int one = 1;
+	if (setsockopt(conn->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+		return errno == EOPNOTSUPP || errno == ENOPROTOOPT ? OPA_ERR_UNSUPPORTED : OPA_ERR_INTERNAL;
+	}
+	opacreactorZc* zc = OPAMALLOC(sizeof(opacreactorZc));
+	if (zc == NULL) {
+		return OPA_ERR_NOMEM;
+	}
+	memset(zc, 0, sizeof(opacreactorZc));
+	zc->minLen = minLen;
+	zc->onSent = conn->funcs.onSent;
+	conn->funcs.onSent = opacreactorZcOnSent;
+	conn->zc = zc;
+	return 0;
+#else
+	UNUSED(conn);
+	UNUSED(minLen);
+	return OPA_ERR_UNSUPPORTED;
+#endif
+}
+
+static size_t opacreactorSendfile(opac* c, int fd, uint64_t offset, size_t len) {
+	opacreactorConn* conn = opacreactorGetConn(c);
+	off_t off = (off_t) offset;
+	ssize_t res;
+	do {
+		res = sendfile(conn->fd, fd, &off, len);
+	} while (res < 0 && errno == EINTR);
+	if (res == 0 && len > 0) {
+		// file is shorter than the length in the request's header; request cannot be completed
+		opacreactorSockErr(conn, EIO);
+	}
+	return opacreactorSendResult(conn, res);
+}
+
+static int opacreactorCtl(opacreactorConn* conn, int op, uint32_t events) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = conn;
+	if (epoll_ctl(conn->r->epfd, op, conn->fd, &ev)) {
+		LOGSYSERRNO();
+		return OPA_ERR_INTERNAL;
+	}
+	return 0;
+}
+
+static void opacreactorSetOut(opacreactorConn* conn, int armed) {
+	if (opacreactorCtl(conn, EPOLL_CTL_MOD, OPAC_REACTOR_EVENTS | (armed ? EPOLLOUT : 0)) == 0) {
+		conn->outArmed = armed ? 1 : 0;
+	}
+}
+
+// return non-zero if every queued request has been written
+static int opacreactorSendDone(opacreactorConn* conn) {
+	opac* c = &conn->c;
+	return c->currSendReq == NULL && c->sendBatchLen == 0 && opaqueuePeek(&c->reqsToSend) == NULL;
+}
+
+// remove EPOLLOUT once all requests are written so that the connection stops getting write events. another
+//  thread can queue a request (and arm EPOLLOUT) between the check and the MOD so check again after
+static void opacreactorDisarmOut(opacreactorConn* conn) {
+	if (conn->outArmed && opacreactorSendDone(conn)) {
+		opacreactorSetOut(conn, 0);
+		if (!opacreactorSendDone(conn)) {
+			opacreactorSetOut(conn, 1);
+		}
+	}
+}
+
+static void opacreactorFreeAddrs(opacreactorConn* conn) {
+	if (conn->addrs != NULL) {
+		freeaddrinfo(conn->addrs);
+		conn->addrs = NULL;
+		conn->nextAddr = NULL;
+	}
+}
+
+// create a non-blocking socket and start connecting it. *pInProgress is set if the connect did not complete
+static int opacreactorConnectSock(const struct sockaddr* addr, socklen_t addrlen, int family, int* pFd, int* pInProgress) {
+	int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		LOGSYSERRNO();
+		return OPA_ERR_INTERNAL;
+	}
+	if (family == AF_INET || family == AF_INET6) {
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	*pInProgress = 0;
+	if (connect(fd, addr, addrlen) != 0) {
+		if (errno != EINPROGRESS) {
+			LOGSYSERRNO();
+			close(fd);
+			return OPA_ERR_INTERNAL;
+		}
+		*pInProgress = 1;
+	}
+	*pFd = fd;
+	return 0;
+}
+
+// the connect to the current address failed: connect a new socket to the next address. the new socket replaces
+//  the old one with dup3() so that conn->fd does not change (other threads may be using it to arm EPOLLOUT)
+// return non-zero if a connect was started
+static int opacreactorConnectRetry(opacreactorConn* conn) {
+	epoll_ctl(conn->r->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	while (conn->nextAddr != NULL) {
+		struct addrinfo* ai = conn->nextAddr;
+		conn->nextAddr = ai->ai_next;
+		int fd;
+		int inProgress;
+		if (opacreactorConnectSock(ai->ai_addr, ai->ai_addrlen, ai->ai_family, &fd, &inProgress)) {
+			continue;
+		}
+		int res = dup3(fd, conn->fd, O_CLOEXEC);
+		close(fd);
+		if (res < 0) {
+			LOGSYSERRNO();
+			break;
+		}
+#ifdef OPAC_REACTOR_HAVEZC
+		int one = 1;
+		if (conn->zc != NULL && setsockopt(conn->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+			conn->zc->minLen = 0;
+		}
+#endif
+		conn->connecting = (char) inProgress;
+		// note: EPOLLOUT signals that the connect completed (or requests can be sent if it already did)
+		if (opacreactorCtl(conn, EPOLL_CTL_ADD, OPAC_REACTOR_EVENTS | EPOLLOUT)) {
+			break;
+		}
+		conn->outArmed = 1;
+		conn->sysErr = 0;
+		conn->closeErr = 0;
+		if (!inProgress) {
+			opacreactorFreeAddrs(conn);
+		}
+		return 1;
+	}
+	opacreactorFreeAddrs(conn);
+	return 0;
+}
+
+static void opacreactorAddPending(opacreactorConn* conn) {
+	opacreactor* r = conn->r;
+	if (conn->pending) {
+		return;
+	}
+	conn->pending = 1;
+	conn->nextPend = NULL;
+	if (r->pendTail == NULL) {
+		r->pendHead = conn;
+	} else {
+		r->pendTail->nextPend = conn;
+	}
+	r->pendTail = conn;
+}
+
+static void opacreactorRemovePending(opacreactorConn* conn) {
+	opacreactor* r = conn->r;
+	if (!conn->pending) {
+		return;
+	}
+	opacreactorConn* prev = NULL;
+	for (opacreactorConn* i = r->pendHead; i != NULL; prev = i, i = i->nextPend) {
+		if (i == conn) {
+			if (prev == NULL) {
+				r->pendHead = i->nextPend;
+			} else {
+				prev->nextPend = i->nextPend;
+			}
+			if (r->pendTail == conn) {
+				r->pendTail = prev;
+			}
+			break;
+		}
+	}
+	conn->pending = 0;
+	conn->nextPend = NULL;
+}
+
+static opacreactorConn* opacreactorPollPending(opacreactor* r) {
+	opacreactorConn* conn = r->pendHead;
+	if (conn != NULL) {
+		r->pendHead = conn->nextPend;
+		if (r->pendHead == NULL) {
+			r->pendTail = NULL;
+		}
+		conn->pending = 0;
+		conn->nextPend = NULL;
+	}
+	return conn;
+}
+
+static void opacreactorRecv(opacreactorConn* conn) {
+	conn->readBlocked = 0;
+	if (opacParseResponses(&conn->c) && !conn->readBlocked && conn->closeErr == 0) {
+		// read budget was used up before socket was drained; must continue later because
+		//  connection is edge-triggered
+		opacreactorAddPending(conn);
+	}
+}
+
+// return non-zero if conn was closed
+static int opacreactorCheckClosed(opacreactorConn* conn) {
+	int err = conn->closeErr;
+	if (err == 0 && !opacIsOpen(&conn->c)) {
+		// client error (ie, parse error or out of memory)
+		err = conn->c.err != 0 ? conn->c.err : OPA_ERR_INTERNAL;
+	}
+	if (err == 0) {
+		return 0;
+	}
+	void (*onClose)(opacreactorConn*, int) = conn->onClose;
+	opacreactorCloseConn(conn);
+	if (onClose != NULL) {
+		onClose(conn, err);
+	}
+	return 1;
+}
+
+static void opacreactorHandleEvent(opacreactorConn* conn, uint32_t events) {
+	if (conn->fd < 0) {
+		// closed while handling an earlier event
+		return;
+	}
+	if (conn->connecting) {
+		int soerr = 0;
+		socklen_t len = sizeof(soerr);
+		if (events & (EPOLLERR | EPOLLHUP)) {
+			if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &soerr, &len) != 0) {
+				soerr = errno;
+			}
+			if (conn->nextAddr != NULL && opacreactorConnectRetry(conn)) {
+				return;
+			}
+			conn->connecting = 0;
+			opacreactorSockErr(conn, soerr != 0 ? soerr : ECONNREFUSED);
+		} else if (events & EPOLLOUT) {
+			conn->connecting = 0;
+			opacreactorFreeAddrs(conn);
+		}
+	}
+	if (events & EPOLLERR) {
+#ifdef OPAC_REACTOR_HAVEZC
+		if (conn->zc != NULL) {
+			opacreactorZcDrain(conn);
+		}
+#endif
+		int soerr = 0;
+		socklen_t len = sizeof(soerr);
+		if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &soerr, &len) == 0 && soerr != 0) {
+			opacreactorSockErr(conn, soerr);
+		}
+	}
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+		opacreactorRemovePending(conn);
+		opacreactorRecv(conn);
+	}
+	if ((events & EPOLLOUT) && conn->closeErr == 0) {
+		// note: another thread may have armed EPOLLOUT
+		conn->outArmed = 1;
+		opacSendRequests(&conn->c);
+		opacreactorDisarmOut(conn);
+	}
+	opacreactorCheckClosed(conn);
+}
+
+int opacreactorRun(opacreactor* r, int timeoutMs) {
+	struct epoll_event evs[OPAC_REACTOR_MAXEVENTS];
+	int n = epoll_wait(r->epfd, evs, OPAC_REACTOR_MAXEVENTS, r->pendHead != NULL ? 0 : timeoutMs);
+	if (n < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		LOGSYSERRNO();
+		return OPA_ERR_INTERNAL;
+	}
+	for (int i = 0; i < n; ++i) {
+		opacreactorHandleEvent(evs[i].data.ptr, evs[i].events);
+	}
+
+	// give connections that used up their read budget another turn. only the connections that are
+	//  in the list now are processed (connections that are added again will wait for the next run)
+	size_t numPend = 0;
+	for (opacreactorConn* i = r->pendHead; i != NULL; i = i->nextPend) {
+		++numPend;
+	}
+	for (; numPend > 0; --numPend) {
+		opacreactorConn* conn = opacreactorPollPending(r);
+		if (conn == NULL) {
+			break;
+		}
+		opacreactorRecv(conn);
+		opacreactorCheckClosed(conn);
+	}
+	return n;
+}
+
+void opacreactorQueueRequest(opacreactorConn* conn, opacReq* req) {
+	// note: outArmed is only maintained by the reactor thread; when requests are queued from other threads then
+	//  EPOLLOUT is armed each time the queue becomes non-empty
+	if (opacQueueRequest(&conn->c, req) && (conn->mt || !conn->outArmed)) {
+		// queue was empty: (re)arm EPOLLOUT. note: modifying an edge-triggered registration will generate
+		//  an event if the socket is already writable; this wakes the reactor thread
+		if (conn->mt) {
+			opacreactorCtl(conn, EPOLL_CTL_MOD, OPAC_REACTOR_EVENTS | EPOLLOUT);
+		} else {
+			opacreactorSetOut(conn, 1);
+		}
+	}
+}
+
+int opacreactorAddFd(opacreactor* r, opacreactorConn* conn, int fd, const opacFuncs* funcs, int mt) {
+	memset(conn, 0, sizeof(opacreactorConn));
+	conn->r = r;
+	conn->fd = fd;
+	conn->funcs = *funcs;
+	conn->funcs.read = opacreactorRead;
+	conn->funcs.write = opacreactorWrite;
+	conn->funcs.writev = opacreactorWritev;
+	conn->funcs.sendfile = opacreactorSendfile;
+	conn->mt = mt ? 1 : 0;
+
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		LOGSYSERRNO();
+		return OPA_ERR_INTERNAL;
+	}
+
+#ifndef OPA_NOTHREADS
+	if (mt) {
+		opacInitMT(&conn->c, &conn->funcs);
+	} else {
+		opacInit(&conn->c, &conn->funcs);
+	}
+#else
+	UNUSED(mt);
+	opacInit(&conn->c, &conn->funcs);
+#endif
+	opacSetReadLen(&conn->c, OPAC_REACTOR_READLEN);
+	opacSetReadBudget(&conn->c, OPAC_REACTOR_READBUDGET, 0);
+
+	int err = opacreactorCtl(conn, EPOLL_CTL_ADD, OPAC_REACTOR_EVENTS);
+	if (err) {
+		opacClose(&conn->c);
+	}
+	return err;
+}
+
+// create non-blocking socket, connect, and add to reactor. socket is closed if an error occurs
+static int opacreactorConnectAddr(opacreactor* r, opacreactorConn* conn, int family, const struct sockaddr* addr, socklen_t addrlen, const opacFuncs* funcs, int mt, int* pInProgress) {
+	int fd;
+	int err = opacreactorConnectSock(addr, addrlen, family, &fd, pInProgress);
+	if (!err) {
+		err = opacreactorAddFd(r, conn, fd, funcs, mt);
+		if (err) {
+			close(fd);
+		}
+	}
+	return err;
+}
+
+int opacreactorConnectTcp(opacreactor* r, opacreactorConn* conn, const char* host, const char* port, const opacFuncs* funcs, int mt) {
+	struct addrinfo hints;
+	struct addrinfo* res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int gaierr = getaddrinfo(host, port, &hints, &res);
+	if (gaierr != 0) {
+		OPALOGERRF("getaddrinfo(%s:%s) failed: %s", host, port, gai_strerror(gaierr));
+		return OPA_ERR_INTERNAL;
+	}
+	int err = OPA_ERR_INTERNAL;
+	int inProgress = 0;
+	struct addrinfo* ai = res;
+	for (; ai != NULL && err; ai = ai->ai_next) {
+		err = opacreactorConnectAddr(r, conn, ai->ai_family, ai->ai_addr, ai->ai_addrlen, funcs, mt, &inProgress);
+	}
+	if (!err && inProgress) {
+		// keep the remaining addresses in case this connect fails. EPOLLOUT signals that the connect completed
+		conn->connecting = 1;
+		if (ai != NULL) {
+			conn->addrs = res;
+			conn->nextAddr = ai;
+			res = NULL;
+		}
+		opacreactorSetOut(conn, 1);
+	}
+	if (res != NULL) {
+		freeaddrinfo(res);
+	}
+	return err;
+}
+
+int opacreactorConnectUnix(opacreactor* r, opacreactorConn* conn, const char* path, const opacFuncs* funcs, int mt) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return OPA_ERR_INVARG;
+	}
+	strcpy(addr.sun_path, path);
+	int inProgress;
+	return opacreactorConnectAddr(r, conn, AF_UNIX, (const struct sockaddr*) &addr, sizeof(addr), funcs, mt, &inProgress);
+}
+
+void opacreactorCloseConn(opacreactorConn* conn) {
+	if (conn->fd < 0) {
+		return;
+	}
+	opacreactorRemovePending(conn);
+	epoll_ctl(conn->r->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	conn->fd = -1;
+	opacreactorFreeAddrs(conn);
+	opacClose(&conn->c);
+	if (conn->zc != NULL) {
+		// note: socket is closed so no more completions will be received
+		opacreactorZcRelease(conn->zc, 1);
+		OPAFREE(conn->zc->buffs);
+		conn->funcs.onSent = conn->zc->onSent;
+		OPAFREE(conn->zc);
+		conn->zc = NULL;
+	}
+}
+
+int opacreactorInit(opacreactor* r) {
+	memset(r, 0, sizeof(opacreactor));
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epfd < 0) {
+		LOGSYSERRNO();
+		return OPA_ERR_INTERNAL;
+	}
+	return 0;
+}
+
+void opacreactorClose(opacreactor* r) {
+	if (r->epfd >= 0) {
+		close(r->epfd);
+		r->epfd = -1;
+	}
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPACREACTOR_H_
+#define OPACREACTOR_H_
+
+#ifdef __linux__
+
+#include "opac.h"
+
+struct addrinfo;
+
+typedef struct opacreactorConn_s opacreactorConn;
+typedef struct opacreactorZc_s opacreactorZc;
+
+typedef struct {
+	int epfd;
+	opacreactorConn* pendHead; // connections that stopped reading because of the read budget
+	opacreactorConn* pendTail;
+} opacreactor;
+
+struct opacreactorConn_s {
+	opac c;
+	opacFuncs funcs;       // copy of user's callbacks with read/write/writev replaced
+	opacreactor* r;
+	int fd;
+	char readBlocked;      // set when read returned EAGAIN
+	char pending;          // non-zero if in reactor's pending list
+	char mt;               // requests can be queued from other threads
+	char outArmed;         // EPOLLOUT is registered (as far as the reactor thread knows; other threads can also arm it)
+	char connecting;       // opacreactorConnectTcp() connect is in progress; EPOLLOUT signals that it completed
+	struct addrinfo* addrs; // addresses from getaddrinfo() while connecting
+	struct addrinfo* nextAddr; // next address to try if the connect fails
+	int sysErr;            // errno of the socket error that closed the connection (0 if none)
+	int closeErr;          // set when connection must be closed; OPA_ERR_EOF or OPA_ERR_INTERNAL
+	opacreactorConn* nextPend;
+	opacreactorZc* zc;     // MSG_ZEROCOPY state; NULL unless enabled with opacreactorEnableZeroCopy()
+
+	// called (from opacreactorRun) after the connection is closed because of EOF or a socket error. err
+	//  is OPA_ERR_EOF or OPA_ERR_INTERNAL (see sysErr). can be null. conn may be freed in this callback
+	void (*onClose)(opacreactorConn* conn, int err);
+	void* udata;
+};
+
+/**
+ * Initialize a reactor that multiplexes many connections on 1 thread with epoll. Connections are
+ * registered edge-triggered; EPOLLOUT is only added while a connection has requests to send and is
+ * removed once they have all been written.
+ * @return 0 on success; else error code
+ */
+int opacreactorInit(opacreactor* r);
+
+/**
+ * Close the reactor. All connections must be closed first with opacreactorCloseConn()
+ */
+void opacreactorClose(opacreactor* r);
+
+/**
+ * Start a non-blocking TCP connection and add it to the reactor. Note: name resolution blocks. If the
+ * connect fails after it was started then the remaining addresses returned by getaddrinfo() are tried
+ * (the socket is replaced; conn->fd does not change).
+ * @param mt non-zero if requests will be queued from threads other than the one calling opacreactorRun()
+ * @return 0 on success; else error code
+ */
+int opacreactorConnectTcp(opacreactor* r, opacreactorConn* conn, const char* host, const char* port, const opacFuncs* funcs, int mt);
+
+/**
+ * Start a non-blocking unix domain socket connection and add it to the reactor.
+ * @return 0 on success; else error code
+ */
+int opacreactorConnectUnix(opacreactor* r, opacreactorConn* conn, const char* path, const opacFuncs* funcs, int mt);
+
+/**
+ * Add a connected (or connecting) socket to the reactor. The socket is switched to non-blocking mode
+ * and is owned by the reactor (closed in opacreactorCloseConn). The read, write, writev and sendfile
+ * callbacks in funcs are ignored (request streams from a file are sent with sendfile(2)); all other
+ * callbacks are called from opacreactorRun(). The opac instance passed to the callbacks is &conn->c
+ * @return 0 on success; else error code
+ */
+int opacreactorAddFd(opacreactor* r, opacreactorConn* conn, int fd, const opacFuncs* funcs, int mt);
+
+/**
+ * Queue a request and wake the reactor if the connection's send queue was empty. Can be called from
+ * any thread if the connection was added with mt set.
+ */
+void opacreactorQueueRequest(opacreactorConn* conn, opacReq* req);
+
+/**
+ * Write requests with MSG_ZEROCOPY (Linux 4.14+, TCP) when a single send has at least minLen bytes so that
+ * large requests are not copied into the kernel. Must be called before any requests are queued. When a
+ * request is written while zerocopy sends are in flight, its rrbuff is detached before onSent is called
+ * (onSent sees an empty rrbuff; opacReqFreeRequest() is still safe) and freed once the kernel reports that
+ * it no longer needs the pages. Completions are read from the socket's error queue in opacreactorRun().
+ * The memory of request streams (opacReqStreamInitMem) is not tracked and must not be modified while
+ * sends are in flight. If the kernel reports that it had to copy the bytes anyway (ie, loopback) then
+ * zerocopy is disabled for the connection. Buffers still waiting when the connection is closed are freed.
+ * @return 0 on success; OPA_ERR_UNSUPPORTED if the socket does not support zerocopy; else error code
+ */
+int opacreactorEnableZeroCopy(opacreactorConn* conn, size_t minLen);
+
+/**
+ * Wait for socket events (up to timeoutMs; -1 to wait forever) and then send/recv on the ready
+ * connections. Must be called by 1 thread at a time. A connection must not be freed during this call
+ * unless it is freed from its own onClose callback.
+ * @return number of events processed or error code
+ */
+int opacreactorRun(opacreactor* r, int timeoutMs);
+
+/**
+ * Close the connection: remove it from the reactor, close the socket and call opacClose() on its
+ * client. onClose is not called.
+ */
+void opacreactorCloseConn(opacreactorConn* conn);
+
+#endif
+
+#endif
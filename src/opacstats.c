@@ -0,0 +1,78 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "opacore.h"
+#include "opacstats.h"
+
+typedef struct {
+	const char* name;
+	const char* type;
+	const char* help;
+	size_t offset;
+} opacStatsMetric;
+
+static const opacStatsMetric OPAC_STATS_METRICS[] = {
+	{"opac_read_bytes_total",        "counter", "Bytes received",                               offsetof(opacStats, bytesReadTotal)},
+	{"opac_written_bytes_total",     "counter", "Bytes written",                                offsetof(opacStats, bytesWrittenTotal)},
+	{"opac_read_calls_total",        "counter", "Calls to the read callback",                   offsetof(opacStats, readCallsTotal)},
+	{"opac_write_calls_total",       "counter", "Calls to the write, writev and sendfile callbacks", offsetof(opacStats, writeCallsTotal)},
+	{"opac_write_stalls_total",      "counter", "Write calls that did not write any bytes",     offsetof(opacStats, writeStallsTotal)},
+	{"opac_responses_total",         "counter", "Responses parsed",                             offsetof(opacStats, responsesTotal)},
+	{"opac_parse_errors_total",      "counter", "Responses that could not be parsed",           offsetof(opacStats, parseErrorsTotal)},
+	{"opac_request_errors_total",    "counter", "Requests passed to the reqErr callback",       offsetof(opacStats, reqErrorsTotal)},
+	{"opac_request_timeouts_total",  "counter", "Requests that expired",                        offsetof(opacStats, timeoutsTotal)},
+	{"opac_requests_to_send",        "gauge",   "Queued requests that are not being written yet", offsetof(opacStats, numToSend)},
+	{"opac_main_requests_pending",   "gauge",   "Non-async requests waiting for a response",    offsetof(opacStats, numMain)},
+	{"opac_async_requests_pending",  "gauge",   "Async requests waiting for a response",        offsetof(opacStats, numAsync)},
+	{"opac_recv_buffer_bytes",       "gauge",   "Capacity of the receive buffer",               offsetof(opacStats, recvBuffBytes)},
+	{"opac_send_buffer_bytes",       "gauge",   "Capacity of the request stream buffer",        offsetof(opacStats, sendBuffBytes)}
+};
+
+// append str to buff. *pLen is the length of the text so far (can exceed buffLen if it does not fit)
+static void opacStatsPut(char* buff, size_t buffLen, size_t* pLen, const char* str) {
+	size_t n = strlen(str);
+	if (*pLen + 1 < buffLen) {
+		size_t avail = buffLen - *pLen - 1;
+		memcpy(buff + *pLen, str, n < avail ? n : avail);
+	}
+	*pLen += n;
+}
+
+size_t opacStatsFormatPrometheusMulti(const opacStatsLabeled* clients, size_t numClients, int withHelp, char* buff, size_t buffLen) {
+	size_t len = 0;
+	for (size_t i = 0; i < sizeof(OPAC_STATS_METRICS) / sizeof(OPAC_STATS_METRICS[0]); ++i) {
+		const opacStatsMetric* m = &OPAC_STATS_METRICS[i];
+		if (withHelp) {
+			const char* parts[] = {"# HELP ", m->name, " ", m->help, "\n# TYPE ", m->name, " ", m->type, "\n"};
+			for (size_t j = 0; j < sizeof(parts) / sizeof(parts[0]); ++j) {
+				opacStatsPut(buff, buffLen, &len, parts[j]);
+			}
+		}
+		for (size_t j = 0; j < numClients; ++j) {
+			const char* labels = clients[j].labels;
+			opacStatsPut(buff, buffLen, &len, m->name);
+			if (labels != NULL && labels[0] != 0) {
+				opacStatsPut(buff, buffLen, &len, "{");
+				opacStatsPut(buff, buffLen, &len, labels);
+				opacStatsPut(buff, buffLen, &len, "}");
+			}
+			char num[32];
+			uint64_t v = *((const uint64_t*) (const void*) (((const uint8_t*) clients[j].stats) + m->offset));
+			opa_snprintf(num, sizeof(num), " %llu\n", (unsigned long long) v);
+			opacStatsPut(buff, buffLen, &len, num);
+		}
+	}
+	if (buffLen > 0) {
+		buff[len < buffLen ? len : buffLen - 1] = 0;
+	}
+	return len;
+}
+
+size_t opacStatsFormatPrometheus(const opacStats* s, const char* labels, int withHelp, char* buff, size_t buffLen) {
+	opacStatsLabeled client = {s, labels};
+	return opacStatsFormatPrometheusMulti(&client, 1, withHelp, buff, buffLen);
+}
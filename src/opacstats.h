@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPACSTATS_H_
+#define OPACSTATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// counters of a client (see opacGetStats). *Total fields only increase; the others are current values
+typedef struct {
+	uint64_t bytesReadTotal;     // bytes received (from the read callback or opacParseData)
+	uint64_t bytesWrittenTotal;
+	uint64_t readCallsTotal;     // calls to the read callback
+	uint64_t writeCallsTotal;    // calls to the write, writev and sendfile callbacks
+	uint64_t writeStallsTotal;   // write calls that returned 0 (ie, socket send buffer is full)
+	uint64_t responsesTotal;     // responses parsed
+	uint64_t parseErrorsTotal;
+	uint64_t reqErrorsTotal;     // requests passed to reqErr (including timeouts)
+	uint64_t timeoutsTotal;      // requests passed to reqErr with OPAC_RER_TIMEOUT
+	uint64_t numToSend;          // requests that are queued and have not been taken to be written
+	uint64_t numMain;            // non-async requests that are written (or being written) and waiting for a response
+	uint64_t numAsync;           // async requests that are written (or being written) and waiting for a response
+	uint64_t recvBuffBytes;      // capacity of the buffer that holds the partial response
+	uint64_t sendBuffBytes;      // capacity of the buffer that request stream bytes are read into
+} opacStats;
+
+// stats of 1 client and the labels that identify its samples (see opacStatsFormatPrometheusMulti)
+typedef struct {
+	const opacStats* stats;
+	const char* labels; // labels without braces (ie, conn="1"); NULL or "" for none
+} opacStatsLabeled;
+
+/**
+ * Format stats in the Prometheus text exposition format (metric names start with "opac_").
+ * @param s Stats to format
+ * @param labels Labels to add to each sample without braces (ie, conn="1"); NULL or "" for none
+ * @param withHelp non-zero to include the # HELP and # TYPE lines
+ * @param buff Where the text is written (null terminated); can be NULL if buffLen is 0
+ * @param buffLen Size of buff
+ * @return number of chars in the text (excluding the null char). if this is not less than buffLen then the
+ *   text was truncated
+ */
+size_t opacStatsFormatPrometheus(const opacStats* s, const char* labels, int withHelp, char* buff, size_t buffLen);
+
+/**
+ * Format the stats of several clients in the Prometheus text exposition format. Each metric is written
+ * once (with its # HELP and # TYPE lines if withHelp is non-zero) followed by a sample for every client;
+ * the labels of each client must be different. Parameters and return value are the same as
+ * opacStatsFormatPrometheus()
+ */
+size_t opacStatsFormatPrometheusMulti(const opacStatsLabeled* clients, size_t numClients, int withHelp, char* buff, size_t buffLen);
+
+#endif
@@ -0,0 +1,612 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE // MSG_NOSIGNAL syscall()
+#endif
+
+#include "opacore.h"
+#include "opacuring.h"
+
+#ifdef __linux__
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// multishot recv and provided buffer rings are the newest features used; older headers cannot build this
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define OPAC_HAVE_URING
+#endif
+
+#endif
+
+#ifdef OPAC_HAVE_URING
+
+#ifndef OPAC_URING_ENTRIES
+#define OPAC_URING_ENTRIES 256
+#endif
+
+// number of provided recv buffers (must be a power of 2) that are shared by all connections on a ring
+#ifndef OPAC_URING_BUFCOUNT
+#define OPAC_URING_BUFCOUNT 256
+#endif
+
+#ifndef OPAC_URING_BUFLEN
+#define OPAC_URING_BUFLEN (1024 * 16)
+#endif
+
+#define OPAC_URING_BGID 0
+
+// low bits of user_data hold the operation; the rest is the connection pointer
+#define OPAC_URING_OP_WAKE 0
+#define OPAC_URING_OP_RECV 1
+#define OPAC_URING_OP_SEND 2
+#define OPAC_URING_OP_MASK 3
+
+
+static opacuringConn* opacuringGetConn(opac* c) {
+	return list_entry(c, opacuringConn, c);
+}
+
+static int opacuringEnter(opacuring* u, unsigned int minComplete, int timeoutMs) {
+	__atomic_store_n(u->sqTail, u->sqLocalTail, __ATOMIC_RELEASE);
+	unsigned int toSubmit = u->sqLocalTail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE);
+	unsigned int flags = 0;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	void* argp = NULL;
+	size_t argsz = 0;
+	if (minComplete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeoutMs >= 0) {
+			memset(&arg, 0, sizeof(arg));
+			ts.tv_sec = timeoutMs / 1000;
+			ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+			arg.ts = (uintptr_t) &ts;
+			argp = &arg;
+			argsz = sizeof(arg);
+			flags |= IORING_ENTER_EXT_ARG;
+		}
+	} else if (toSubmit == 0) {
+		return 0;
+	}
+	long res = syscall(__NR_io_uring_enter, u->fd, toSubmit, minComplete, flags, argp, argsz);
+	if (res < 0) {
+		if (errno == EINTR || errno == ETIME || errno == EAGAIN || errno == EBUSY) {
+			return 0;
+		}
+		LOGSYSERRNO();
+		return OPA_ERR_INTERNAL;
+	}
+	return (int) res;
+}
+
+static struct io_uring_sqe* opacuringGetSqe(opacuring* u) {
+	if (u->sqLocalTail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) >= u->sqEntries) {
+		// submission queue is full; submit without waiting
+		if (opacuringEnter(u, 0, 0) < 0) {
+			return NULL;
+		}
+		if (u->sqLocalTail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) >= u->sqEntries) {
+			return NULL;
+		}
+	}
+	struct io_uring_sqe* sqe = &((struct io_uring_sqe*) u->sqes)[u->sqLocalTail & *u->sqMask];
+	++u->sqLocalTail;
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+static void opacuringRecycleBuf(opacuring* u, unsigned int bid) {
+	struct io_uring_buf* ring = u->bufRing;
+	struct io_uring_buf* b = &ring[u->bufTail & (u->bufCount - 1)];
+	b->addr = (uintptr_t) (u->bufs + (size_t) bid * (u->bufLen + 1));
+	b->len = u->bufLen;
+	b->bid = bid;
+	++u->bufTail;
+	// note: ring tail overlays the resv field of the first entry
+	__atomic_store_n((uint16_t*) ((uint8_t*) u->bufRing + offsetof(struct io_uring_buf, resv)), u->bufTail, __ATOMIC_RELEASE);
+}
+
+static void opacuringArmWake(opacuring* u) {
+	struct io_uring_sqe* sqe = opacuringGetSqe(u);
+	if (sqe == NULL) {
+		OPALOGERR("could not arm wake");
+		return;
+	}
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = u->wakeFd;
+	sqe->addr = (uintptr_t) &u->wakeVal;
+	sqe->len = sizeof(u->wakeVal);
+	sqe->user_data = OPAC_URING_OP_WAKE;
+}
+
+static void opacuringAddReady(opacuringConn* conn) {
+	if (__atomic_exchange_n(&conn->inReady, 1, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+	opacuring* u = conn->u;
+	opacuringConn* head = __atomic_load_n(&u->ready, __ATOMIC_RELAXED);
+	do {
+		conn->nextReady = head;
+	} while (!__atomic_compare_exchange_n(&u->ready, &head, conn, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	if (head == NULL && conn->mt) {
+		// list was empty: ring thread may be waiting for completions
+		uint64_t one = 1;
+		if (write(u->wakeFd, &one, sizeof(one)) < 0) {
+			LOGSYSERRNO();
+		}
+	}
+}
+
+static void opacuringStartClose(opacuringConn* conn, int err, int sysErr) {
+	if (conn->closing) {
+		return;
+	}
+	conn->closing = 1;
+	conn->closeErr = err;
+	conn->sysErr = sysErr;
+	// note: pending recv completes with 0 and pending send completes with an error
+	shutdown(conn->fd, SHUT_RDWR);
+	opacuringAddReady(conn);
+}
+
+static void opacuringPrepRecv(opacuringConn* conn, struct io_uring_sqe* sqe) {
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = OPAC_URING_BGID;
+	sqe->ioprio = conn->multishot ? IORING_RECV_MULTISHOT : 0;
+	sqe->user_data = (uintptr_t) conn | OPAC_URING_OP_RECV;
+	conn->recvArmed = 1;
+}
+
+static void opacuringArmRecv(opacuringConn* conn) {
+	struct io_uring_sqe* sqe = opacuringGetSqe(conn->u);
+	if (sqe == NULL) {
+		opacuringStartClose(conn, OPA_ERR_INTERNAL, 0);
+		return;
+	}
+	opacuringPrepRecv(conn, sqe);
+}
+
+static void opacuringFlush(opacuringConn* conn) {
+	opacSendRequests(&conn->c);
+}
+
+// requests are sent from the client's buffers without copying. the buffers must stay valid until the send
+//  completes so bytes are only reported as written (and requests passed to onSent) after the send's completion
+//  arrives. until then the client keeps the requests in its send batch and passes the same bytes again
+static size_t opacuringWritev(opac* c, const opacIoVec* iov, int iovcnt) {
+	opacuringConn* conn = opacuringGetConn(c);
+	if (conn->closing || conn->sending || iovcnt <= 0) {
+		return 0;
+	}
+	if (conn->sendDone > 0) {
+		size_t n = conn->sendDone;
+		conn->sendDone = 0;
+		if (iov[0].buff != conn->sendIov[0].iov_base) {
+			// the client must pass the bytes of the completed send first
+			opacuringStartClose(conn, OPA_ERR_INTERNAL, 0);
+			return 0;
+		}
+		return n;
+	}
+	struct io_uring_sqe* sqe = opacuringGetSqe(conn->u);
+	if (sqe == NULL) {
+		opacuringStartClose(conn, OPA_ERR_INTERNAL, 0);
+		return 0;
+	}
+	for (int i = 0; i < iovcnt; ++i) {
+		conn->sendIov[i].iov_base = (void*) iov[i].buff;
+		conn->sendIov[i].iov_len = iov[i].len;
+	}
+	memset(&conn->sendMsg, 0, sizeof(conn->sendMsg));
+	conn->sendMsg.msg_iov = conn->sendIov;
+	conn->sendMsg.msg_iovlen = iovcnt;
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = conn->fd;
+	sqe->addr = (uintptr_t) &conn->sendMsg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uintptr_t) conn | OPAC_URING_OP_SEND;
+	conn->sending = 1;
+	return 0;
+}
+
+static size_t opacuringWrite(opac* c, const void* buff, size_t len) {
+	opacIoVec iov;
+	iov.buff = buff;
+	iov.len = len;
+	return opacuringWritev(c, &iov, 1);
+}
+
+static size_t opacuringRead(opac* c, void* buff, size_t len) {
+	// responses are passed to opacParseData() when recv completions arrive
+	UNUSED(c);
+	UNUSED(buff);
+	UNUSED(len);
+	return 0;
+}
+
+static void opacuringOnRecv(opacuringConn* conn, int res, unsigned int flags) {
+	opacuring* u = conn->u;
+	if (!(flags & IORING_CQE_F_MORE)) {
+		conn->recvArmed = 0;
+	}
+	if (res > 0) {
+		if (flags & IORING_CQE_F_BUFFER) {
+			unsigned int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+			if (!conn->closing && opacParseData(&conn->c, u->bufs + (size_t) bid * (u->bufLen + 1), res)) {
+				opacuringStartClose(conn, conn->c.err, 0);
+			}
+			// note: opacParseData() copies everything it keeps so the buffer can be reused right away
+			opacuringRecycleBuf(u, bid);
+		}
+	} else if (res == 0) {
+		opacuringStartClose(conn, OPA_ERR_EOF, 0);
+	} else if (res == -EINVAL && conn->multishot) {
+		// kernel does not support multishot recv; re-arm single shot
+		conn->multishot = 0;
+	} else if (res != -ENOBUFS) {
+		// note: ENOBUFS means all provided buffers were in use; re-arm
+		opacuringStartClose(conn, OPA_ERR_INTERNAL, -res);
+	}
+	if (!conn->recvArmed && !conn->closing) {
+		opacuringArmRecv(conn);
+	}
+}
+
+static void opacuringOnSend(opacuringConn* conn, int res) {
+	conn->sending = 0;
+	if (res <= 0) {
+		opacuringStartClose(conn, OPA_ERR_INTERNAL, res < 0 ? -res : 0);
+		return;
+	}
+	if (conn->closing) {
+		return;
+	}
+	// note: the client takes the sent bytes with the next writev call and calls onSent for written requests
+	conn->sendDone = (size_t) res;
+	opacuringFlush(conn);
+}
+
+// called when no operations reference conn anymore
+static void opacuringFinishClose(opacuringConn* conn) {
+	opacClose(&conn->c);
+	close(conn->fd);
+	conn->fd = -1;
+	--conn->u->numConns;
+	int err = conn->closeErr;
+	if (conn->onClose != NULL) {
+		conn->onClose(conn, err);
+	}
+}
+
+static void opacuringProcessReady(opacuring* u) {
+	opacuringConn* list = __atomic_exchange_n(&u->ready, NULL, __ATOMIC_ACQUIRE);
+	// list was built lifo; reverse so connections are flushed in the order they became ready
+	opacuringConn* prev = NULL;
+	while (list != NULL) {
+		opacuringConn* next = list->nextReady;
+		list->nextReady = prev;
+		prev = list;
+		list = next;
+	}
+	for (opacuringConn* conn = prev; conn != NULL;) {
+		opacuringConn* next = conn->nextReady;
+		// note: must be seq_cst. a release store could be reordered after the loads of the request queue in
+		//  opacuringFlush(); a producer could then see inReady set and skip adding conn (and the wake) while
+		//  the flush sees an empty queue
+		__atomic_exchange_n(&conn->inReady, 0, __ATOMIC_SEQ_CST);
+		if (!conn->closing) {
+			opacuringFlush(conn);
+		} else if (!conn->recvArmed && !conn->sending) {
+			opacuringFinishClose(conn);
+		}
+		conn = next;
+	}
+}
+
+static void opacuringHandleCqe(opacuring* u, uint64_t userData, int res, unsigned int flags) {
+	unsigned int op = userData & OPAC_URING_OP_MASK;
+	if (op == OPAC_URING_OP_WAKE) {
+		opacuringArmWake(u);
+		return;
+	}
+	opacuringConn* conn = (opacuringConn*) (uintptr_t) (userData & ~(uint64_t) OPAC_URING_OP_MASK);
+	if (op == OPAC_URING_OP_RECV) {
+		opacuringOnRecv(conn, res, flags);
+	} else {
+		opacuringOnSend(conn, res);
+	}
+	if (!conn->closing && !opacIsOpen(&conn->c)) {
+		opacuringStartClose(conn, conn->c.err != 0 ? conn->c.err : OPA_ERR_INTERNAL, 0);
+	}
+	if (conn->closing && !conn->recvArmed && !conn->sending) {
+		// note: onClose is called from opacuringProcessReady() because conn may be in the ready list
+		opacuringAddReady(conn);
+	}
+}
+
+int opacuringRun(opacuring* u, int timeoutMs) {
+	opacuringProcessReady(u);
+	unsigned int cqHead = *u->cqHead;
+	unsigned int minComplete = timeoutMs != 0 && cqHead == __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE) ? 1 : 0;
+	// note: pending submissions are made with the same syscall that waits for completions
+	int err = opacuringEnter(u, minComplete, timeoutMs);
+	if (err < 0) {
+		return err;
+	}
+	unsigned int cqTail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+	int n = 0;
+	for (; cqHead != cqTail; ++cqHead, ++n) {
+		struct io_uring_cqe* cqe = &((struct io_uring_cqe*) u->cqes)[cqHead & *u->cqMask];
+		uint64_t userData = cqe->user_data;
+		int res = cqe->res;
+		unsigned int flags = cqe->flags;
+		// release the cqe before handling it (handler can submit more operations)
+		__atomic_store_n(u->cqHead, cqHead + 1, __ATOMIC_RELEASE);
+		opacuringHandleCqe(u, userData, res, flags);
+	}
+	// flush requests that were queued by callbacks. sends are submitted with the next run
+	opacuringProcessReady(u);
+	return n;
+}
+
+void opacuringQueueRequest(opacuringConn* conn, opacReq* req) {
+	if (opacQueueRequest(&conn->c, req)) {
+		opacuringAddReady(conn);
+	}
+}
+
+void opacuringCloseConn(opacuringConn* conn) {
+	opacuringStartClose(conn, 0, 0);
+}
+
+int opacuringAddFd(opacuring* u, opacuringConn* conn, int fd, const opacFuncs* funcs, void (*onClose)(opacuringConn*, int), int mt) {
+	// get the sqe for the first recv before anything else so that nothing needs to be undone if the
+	//  submission queue is full (opacuringArmRecv() would shut down the socket and add conn to the ready list)
+	struct io_uring_sqe* sqe = opacuringGetSqe(u);
+	if (sqe == NULL) {
+		return OPA_ERR_INTERNAL;
+	}
+	memset(conn, 0, sizeof(opacuringConn));
+	conn->u = u;
+	conn->fd = fd;
+	conn->mt = mt;
+	conn->multishot = 1;
+	conn->onClose = onClose;
+	conn->funcs = *funcs;
+	conn->funcs.read = opacuringRead;
+	conn->funcs.write = opacuringWrite;
+	conn->funcs.writev = opacuringWritev;
+	conn->funcs.sendfile = NULL; // note: file streams are read into a buffer and copied like other request bytes
+#ifndef OPA_NOTHREADS
+	if (mt) {
+		opacInitMT(&conn->c, &conn->funcs);
+	} else {
+		opacInit(&conn->c, &conn->funcs);
+	}
+#else
+	opacInit(&conn->c, &conn->funcs);
+#endif
+	opacuringPrepRecv(conn, sqe);
+	++u->numConns;
+	return 0;
+}
+
+static void opacuringUnmap(opacuring* u) {
+	if (u->sqes != NULL) {
+		munmap(u->sqes, u->sqesSize);
+	}
+	if (u->cqRing != NULL && u->cqRing != u->sqRing) {
+		munmap(u->cqRing, u->cqRingSize);
+	}
+	if (u->sqRing != NULL) {
+		munmap(u->sqRing, u->sqRingSize);
+	}
+	if (u->bufRing != NULL) {
+		munmap(u->bufRing, u->bufRingSize);
+	}
+}
+
+static void* opacuringMap(int fd, size_t len, off_t off) {
+	void* p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, off);
+	if (p == MAP_FAILED) {
+		LOGSYSERRNO();
+		return NULL;
+	}
+	return p;
+}
+
+static int opacuringSetup(opacuring* u, unsigned int entries) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0 && errno == EINVAL) {
+		memset(&p, 0, sizeof(p));
+		u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	}
+	if (u->fd < 0) {
+		int err = errno;
+		LOGSYSERR(err);
+		return err == ENOSYS || err == EPERM || err == EINVAL ? OPA_ERR_UNSUPPORTED : OPA_ERR_INTERNAL;
+	}
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		return OPA_ERR_UNSUPPORTED;
+	}
+	u->features = p.features;
+	u->sqEntries = p.sq_entries;
+	u->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cqRingSize > u->sqRingSize) {
+			u->sqRingSize = u->cqRingSize;
+		}
+		u->cqRingSize = u->sqRingSize;
+	}
+	u->sqRing = opacuringMap(u->fd, u->sqRingSize, IORING_OFF_SQ_RING);
+	if (u->sqRing == NULL) {
+		return OPA_ERR_INTERNAL;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cqRing = u->sqRing;
+	} else {
+		u->cqRing = opacuringMap(u->fd, u->cqRingSize, IORING_OFF_CQ_RING);
+		if (u->cqRing == NULL) {
+			return OPA_ERR_INTERNAL;
+		}
+	}
+	u->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = opacuringMap(u->fd, u->sqesSize, IORING_OFF_SQES);
+	if (u->sqes == NULL) {
+		return OPA_ERR_INTERNAL;
+	}
+
+	uint8_t* sq = u->sqRing;
+	uint8_t* cq = u->cqRing;
+	u->sqHead = (unsigned int*) (sq + p.sq_off.head);
+	u->sqTail = (unsigned int*) (sq + p.sq_off.tail);
+	u->sqMask = (unsigned int*) (sq + p.sq_off.ring_mask);
+	u->sqArray = (unsigned int*) (sq + p.sq_off.array);
+	u->cqHead = (unsigned int*) (cq + p.cq_off.head);
+	u->cqTail = (unsigned int*) (cq + p.cq_off.tail);
+	u->cqMask = (unsigned int*) (cq + p.cq_off.ring_mask);
+	u->cqes = cq + p.cq_off.cqes;
+	u->sqLocalTail = *u->sqTail;
+	// sqes are always used in ring order so the indirection array is set up once
+	for (unsigned int i = 0; i < p.sq_entries; ++i) {
+		u->sqArray[i] = i;
+	}
+	return 0;
+}
+
+static int opacuringSetupBufs(opacuring* u) {
+	SASSERT((OPAC_URING_BUFCOUNT & (OPAC_URING_BUFCOUNT - 1)) == 0 && OPAC_URING_BUFCOUNT <= 32768);
+	u->bufCount = OPAC_URING_BUFCOUNT;
+	u->bufLen = OPAC_URING_BUFLEN;
+	u->bufRingSize = u->bufCount * sizeof(struct io_uring_buf);
+	u->bufRing = mmap(NULL, u->bufRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (u->bufRing == MAP_FAILED) {
+		u->bufRing = NULL;
+		LOGSYSERRNO();
+		return OPA_ERR_NOMEM;
+	}
+	// note: each buffer has an extra byte for the null terminator that the parser requires
+	u->bufs = OPAMALLOC((size_t) u->bufCount * (u->bufLen + 1));
+	if (u->bufs == NULL) {
+		return OPA_ERR_NOMEM;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t) u->bufRing;
+	reg.ring_entries = u->bufCount;
+	reg.bgid = OPAC_URING_BGID;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		int err = errno;
+		LOGSYSERR(err);
+		return err == EINVAL ? OPA_ERR_UNSUPPORTED : OPA_ERR_INTERNAL;
+	}
+	for (unsigned int i = 0; i < u->bufCount; ++i) {
+		opacuringRecycleBuf(u, i);
+	}
+	return 0;
+}
+
+int opacuringInit(opacuring* u, unsigned int entries) {
+	memset(u, 0, sizeof(opacuring));
+	u->wakeFd = -1;
+	int err = opacuringSetup(u, entries > 0 ? entries : OPAC_URING_ENTRIES);
+	if (!err) {
+		err = opacuringSetupBufs(u);
+	}
+	if (!err) {
+		u->wakeFd = eventfd(0, EFD_CLOEXEC);
+		if (u->wakeFd < 0) {
+			LOGSYSERRNO();
+			err = OPA_ERR_INTERNAL;
+		}
+	}
+	if (err) {
+		opacuringClose(u);
+		return err;
+	}
+	opacuringArmWake(u);
+	return 0;
+}
+
+void opacuringClose(opacuring* u) {
+	OASSERT(u->numConns == 0);
+	if (u->fd >= 0) {
+		// note: closing the ring cancels the pending wake read
+		close(u->fd);
+		u->fd = -1;
+	}
+	opacuringUnmap(u);
+	if (u->wakeFd >= 0) {
+		close(u->wakeFd);
+		u->wakeFd = -1;
+	}
+	OPAFREE(u->bufs);
+	memset(u, 0, sizeof(opacuring));
+	u->fd = -1;
+	u->wakeFd = -1;
+}
+
+#elif defined(__linux__)
+
+// kernel headers are too old for the features that are used
+
+int opacuringInit(opacuring* u, unsigned int entries) {
+	UNUSED(entries);
+	memset(u, 0, sizeof(opacuring));
+	u->fd = -1;
+	u->wakeFd = -1;
+	return OPA_ERR_UNSUPPORTED;
+}
+
+void opacuringClose(opacuring* u) {
+	UNUSED(u);
+}
+
+int opacuringAddFd(opacuring* u, opacuringConn* conn, int fd, const opacFuncs* funcs, void (*onClose)(opacuringConn*, int), int mt) {
+	UNUSED(u);
+	UNUSED(conn);
+	UNUSED(fd);
+	UNUSED(funcs);
+	UNUSED(onClose);
+	UNUSED(mt);
+	return OPA_ERR_UNSUPPORTED;
+}
+
+void opacuringQueueRequest(opacuringConn* conn, opacReq* req) {
+	opacQueueRequest(&conn->c, req);
+}
+
+int opacuringRun(opacuring* u, int timeoutMs) {
+	UNUSED(u);
+	UNUSED(timeoutMs);
+	return OPA_ERR_UNSUPPORTED;
+}
+
+void opacuringCloseConn(opacuringConn* conn) {
+	UNUSED(conn);
+}
+
+#endif
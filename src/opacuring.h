@@ -0,0 +1,125 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPACURING_H_
+#define OPACURING_H_
+
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "opac.h"
+
+typedef struct opacuringConn_s opacuringConn;
+
+typedef struct {
+	int fd;
+	unsigned int features;
+	unsigned int sqEntries;
+	unsigned int* sqHead;
+	unsigned int* sqTail;
+	unsigned int* sqMask;
+	unsigned int* sqArray;
+	unsigned int sqLocalTail; // sqes that have been filled but not yet published to the kernel
+	unsigned int sqPublished;
+	unsigned int* cqHead;
+	unsigned int* cqTail;
+	unsigned int* cqMask;
+	void* cqes;
+	void* sqes;
+	void* sqRing;
+	size_t sqRingSize;
+	void* cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+
+	// provided buffer ring (multishot recv picks buffers from here)
+	void* bufRing;
+	size_t bufRingSize;
+	uint8_t* bufs;
+	unsigned int bufCount;
+	unsigned int bufLen;
+	unsigned short bufTail;
+
+	int wakeFd;             // eventfd used by other threads to wake the ring
+	uint64_t wakeVal;
+	opacuringConn* ready;   // connections whose send queue was empty when a request was queued
+	unsigned int numConns;
+} opacuring;
+
+struct opacuringConn_s {
+	opac c;
+	opacFuncs funcs;     // copy of user's callbacks with read/write/writev replaced
+	opacuring* u;
+	int fd;
+	int mt;
+	int sysErr;          // errno of the socket error that closed the connection (0 if none)
+	int closeErr;        // set when connection is closing; OPA_ERR_EOF, OPA_ERR_INTERNAL or the client's error
+	char recvArmed;
+	char multishot;      // cleared if the kernel does not support multishot recv
+	char sending;        // non-zero while a send is in flight
+	char closing;
+	int inReady;         // non-zero if in u->ready list
+	opacuringConn* nextReady;
+	size_t sendDone;     // bytes of the completed send that have not been reported to the client yet
+	struct iovec sendIov[OPAC_WRITEVLEN]; // client's buffers referenced by the in-flight send
+	struct msghdr sendMsg;
+
+	// called (from opacuringRun) when the connection has been closed and no operations are pending.
+	//  err is OPA_ERR_EOF, OPA_ERR_INTERNAL (see sysErr), the client's error code, or 0 if closed with
+	//  opacuringCloseConn(). required. conn may be freed in this callback
+	void (*onClose)(opacuringConn* conn, int err);
+	void* udata;
+};
+
+/**
+ * Initialize an io_uring that drives many connections from 1 thread. Responses are received with a
+ * multishot recv per connection into a ring of provided buffers and are parsed straight from those
+ * buffers; queued requests are gathered (up to OPAC_WRITEVLEN) and sent from their buffers without
+ * copying with 1 sendmsg per connection at a time. A request is passed to onSent once the send that
+ * contains its last byte completes (as when it is written to a socket). Submissions are batched
+ * and made with the same syscall that waits for completions. Requires kernel 6.0 or newer.
+ * @param entries Number of submission queue entries (0 for default)
+ * @return 0 on success; OPA_ERR_UNSUPPORTED if io_uring or a required feature is not available; else error code
+ */
+int opacuringInit(opacuring* u, unsigned int entries);
+
+/**
+ * Close the ring. All connections must have been closed first (their onClose callbacks have been called)
+ */
+void opacuringClose(opacuring* u);
+
+/**
+ * Add a connected socket to the ring. The socket is owned by the ring (closed before onClose is called).
+ * The read, write, writev and sendfile callbacks in funcs are ignored; all other callbacks are called
+ * from opacuringRun(). The opac instance passed to the callbacks is &conn->c
+ * @param mt non-zero if requests will be queued from threads other than the one calling opacuringRun()
+ * @return 0 on success; else error code (fd is not closed)
+ */
+int opacuringAddFd(opacuring* u, opacuringConn* conn, int fd, const opacFuncs* funcs, void (*onClose)(opacuringConn*, int), int mt);
+
+/**
+ * Queue a request. The connection is flushed by the next opacuringRun(). Can be called from any thread
+ * if the connection was added with mt set (the ring is woken if necessary).
+ */
+void opacuringQueueRequest(opacuringConn* conn, opacReq* req);
+
+/**
+ * Submit pending operations and wait for completions (up to timeoutMs; -1 to wait forever) then
+ * process all completions. Must be called by 1 thread at a time.
+ * @return number of completions processed or error code
+ */
+int opacuringRun(opacuring* u, int timeoutMs);
+
+/**
+ * Start closing the connection. The socket is shut down; conn->onClose is called from opacuringRun()
+ * once the kernel no longer references conn. conn must not be freed before then.
+ */
+void opacuringCloseConn(opacuringConn* conn);
+
+#endif
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "opacore.h"
+#include "opacwheel.h"
+
+#define OPAC_WHEEL_BITS 6
+#define OPAC_WHEEL_SLOTS (1 << OPAC_WHEEL_BITS)
+#define OPAC_WHEEL_OVERFLOW (OPAC_WHEEL_LEVELS * OPAC_WHEEL_SLOTS)
+#define OPAC_WHEEL_LEVELMASK(l) ((((uint64_t) 1) << (OPAC_WHEEL_BITS * (l))) - 1)
+
+
+void opacwheelLock(opacwheel* w) {
+	#ifndef OPA_NOTHREADS
+		if (w->sync) {
+			opamutexLock(&w->m);
+		}
+	#else
+		UNUSED(w);
+	#endif
+}
+
+void opacwheelUnlock(opacwheel* w) {
+	#ifndef OPA_NOTHREADS
+		if (w->sync) {
+			opamutexUnlock(&w->m);
+		}
+	#else
+		UNUSED(w);
+	#endif
+}
+
+void opacwheelInit(opacwheel* w) {
+	memset(w, 0, sizeof(opacwheel));
+}
+
+#ifndef OPA_NOTHREADS
+void opacwheelInitMT(opacwheel* w) {
+	opacwheelInit(w);
+	opamutexInit(&w->m);
+	w->sync = 1;
+}
+#endif
+
+void opacwheelClose(opacwheel* w) {
+	#ifndef OPA_NOTHREADS
+		if (w->sync) {
+			opamutexDestroy(&w->m);
+		}
+	#endif
+	OPAFREE(w->slots);
+	w->slots = NULL;
+	w->count = 0;
+}
+
+static void opacwheelLink(opacwheel* w, size_t idx, opacwheelItem* i) {
+	opacwheelItem** head = &w->slots[idx];
+	i->next = *head;
+	if (i->next != NULL) {
+		i->next->pprev = &i->next;
+	}
+	i->pprev = head;
+	*head = i;
+	if (idx < OPAC_WHEEL_OVERFLOW) {
+		w->occupied[idx / OPAC_WHEEL_SLOTS] |= ((uint64_t) 1) << (idx % OPAC_WHEEL_SLOTS);
+	}
+}
+
+// note: the occupied bit of the slot is not cleared when it becomes empty; it is cleared when the slot is processed
+static void opacwheelUnlink(opacwheelItem* i) {
+	*i->pprev = i->next;
+	if (i->next != NULL) {
+		i->next->pprev = i->pprev;
+	}
+	i->next = NULL;
+	i->pprev = NULL;
+}
+
+// place item in the level where its deadline shares all higher bits with ref (the tick being processed, or the
+//  next tick). ref must be in the first slot of the level that is not processed yet
+static void opacwheelInsert(opacwheel* w, opacwheelItem* i, uint64_t ref) {
+	uint64_t d = i->deadline < ref ? ref : i->deadline;
+	for (unsigned int l = 0; l < OPAC_WHEEL_LEVELS; ++l) {
+		unsigned int shift = OPAC_WHEEL_BITS * (l + 1);
+		if ((d >> shift) == (ref >> shift)) {
+			opacwheelLink(w, l * OPAC_WHEEL_SLOTS + ((d >> (OPAC_WHEEL_BITS * l)) & (OPAC_WHEEL_SLOTS - 1)), i);
+			return;
+		}
+	}
+	opacwheelLink(w, OPAC_WHEEL_OVERFLOW, i);
+}
+
+int opacwheelAdd(opacwheel* w, opacwheelItem* i, uint64_t now) {
+	SASSERT(OPAC_WHEEL_LEVELS > 0 && OPAC_WHEEL_BITS * OPAC_WHEEL_LEVELS < 64);
+	if (w->slots == NULL) {
+		w->slots = OPAMALLOC((OPAC_WHEEL_OVERFLOW + 1) * sizeof(opacwheelItem*));
+		if (w->slots == NULL) {
+			return OPA_ERR_NOMEM;
+		}
+		memset(w->slots, 0, (OPAC_WHEEL_OVERFLOW + 1) * sizeof(opacwheelItem*));
+	}
+	if (w->count == 0 && now > w->now) {
+		w->now = now;
+	}
+	opacwheelInsert(w, i, w->now + 1);
+	++w->count;
+	return 0;
+}
+
+void opacwheelRemove(opacwheel* w, opacwheelItem* i) {
+	if (i->pprev != NULL) {
+		opacwheelUnlink(i);
+		--w->count;
+	}
+}
+
+// detach the list in slot idx so that it can be processed while items are added to the wheel
+static opacwheelItem* opacwheelTake(opacwheel* w, size_t idx) {
+	opacwheelItem* list = w->slots[idx];
+	w->slots[idx] = NULL;
+	if (idx < OPAC_WHEEL_OVERFLOW) {
+		w->occupied[idx / OPAC_WHEEL_SLOTS] &= ~(((uint64_t) 1) << (idx % OPAC_WHEEL_SLOTS));
+	}
+	return list;
+}
+
+static void opacwheelCascade(opacwheel* w, size_t idx, uint64_t t) {
+	opacwheelItem* list = opacwheelTake(w, idx);
+	if (list != NULL) {
+		list->pprev = &list;
+	}
+	while (list != NULL) {
+		opacwheelItem* i = list;
+		opacwheelUnlink(i);
+		opacwheelInsert(w, i, t);
+	}
+}
+
+static void opacwheelTick(opacwheel* w, uint64_t t, void* context, void (*cb)(void* context, opacwheelItem* i)) {
+	w->now = t;
+	// move items from higher levels down before expiring the items in level 0 (highest level first)
+	if ((t & OPAC_WHEEL_LEVELMASK(OPAC_WHEEL_LEVELS)) == 0) {
+		opacwheelCascade(w, OPAC_WHEEL_OVERFLOW, t);
+	}
+	for (unsigned int l = OPAC_WHEEL_LEVELS - 1; l > 0; --l) {
+		if ((t & OPAC_WHEEL_LEVELMASK(l)) == 0) {
+			opacwheelCascade(w, l * OPAC_WHEEL_SLOTS + ((t >> (OPAC_WHEEL_BITS * l)) & (OPAC_WHEEL_SLOTS - 1)), t);
+		}
+	}
+	opacwheelItem* list = opacwheelTake(w, t & (OPAC_WHEEL_SLOTS - 1));
+	if (list != NULL) {
+		list->pprev = &list;
+	}
+	while (list != NULL) {
+		opacwheelItem* i = list;
+		opacwheelUnlink(i);
+		--w->count;
+		cb(context, i);
+	}
+}
+
+void opacwheelAdvance(opacwheel* w, uint64_t now, void* context, void (*cb)(void* context, opacwheelItem* i)) {
+	while (w->now < now) {
+		if (w->count == 0) {
+			w->now = now;
+			break;
+		}
+		uint64_t t = w->now + 1;
+		unsigned int l = 0;
+		while (l < OPAC_WHEEL_LEVELS && w->occupied[l] == 0) {
+			++l;
+		}
+		if (l > 0) {
+			// levels below l are empty: nothing happens until the next slot of level l is cascaded
+			unsigned int shift = OPAC_WHEEL_BITS * l;
+			t = ((w->now >> shift) + 1) << shift;
+			if (t > now) {
+				w->now = now;
+				break;
+			}
+		}
+		opacwheelTick(w, t, context, cb);
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPACWHEEL_H_
+#define OPACWHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef OPA_NOTHREADS
+#include "opamutex.h"
+#endif
+
+// number of levels in the wheel; each level has 64 slots and each slot covers 64 times the time span of a
+//  slot in the level below it. deadlines further out than 64^levels ticks wait in an overflow list
+#ifndef OPAC_WHEEL_LEVELS
+#define OPAC_WHEEL_LEVELS 4
+#endif
+
+typedef struct opacwheelItem_s opacwheelItem;
+
+struct opacwheelItem_s {
+	opacwheelItem* next;
+	opacwheelItem** pprev; // NULL if item is not in a wheel
+	uint64_t deadline;     // tick when the item expires
+};
+
+typedef struct {
+#ifndef OPA_NOTHREADS
+	opamutex m;
+	char sync;
+#endif
+	opacwheelItem** slots; // 64 lists per level followed by the overflow list; allocated when first item is added
+	uint64_t occupied[OPAC_WHEEL_LEVELS]; // bit is set for each non-empty slot
+	uint64_t now;          // last tick that was processed
+	size_t count;
+} opacwheel;
+
+void opacwheelInit(opacwheel* w);
+#ifndef OPA_NOTHREADS
+void opacwheelInitMT(opacwheel* w);
+#endif
+void opacwheelClose(opacwheel* w);
+
+// the following functions do not lock the wheel. if the wheel was initialized with opacwheelInitMT() then the
+//  lock must be held while calling them
+
+void opacwheelLock(opacwheel* w);
+void opacwheelUnlock(opacwheel* w);
+
+/**
+ * Add an item that expires at i->deadline. An item whose deadline has passed expires on the next tick.
+ * If the wheel is empty then it is moved ahead to now first (now is the caller's current tick).
+ * @return 0 on success; else error code
+ */
+int opacwheelAdd(opacwheel* w, opacwheelItem* i, uint64_t now);
+
+/**
+ * Remove an item. Does nothing if the item is not in the wheel (ie, it already expired)
+ */
+void opacwheelRemove(opacwheel* w, opacwheelItem* i);
+
+/**
+ * Process every tick up to and including now. Each item that expires is removed from the wheel and
+ * then passed to cb. The callback can add the item again.
+ */
+void opacwheelAdvance(opacwheel* w, uint64_t now, void* context, void (*cb)(void* context, opacwheelItem* i));
+
+#endif
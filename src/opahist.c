@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include <string.h>
+
+#include "opacore.h"
+#include "opahist.h"
+
+#define OPAHIST_SUBCOUNT (1 << OPAHIST_SUBBITS)
+
+
+// index of the most significant bit that is set. v must not be 0
+static unsigned int opahistMsb(uint64_t v) {
+#ifdef __GNUC__
+	return 63 - (unsigned int) __builtin_clzll(v);
+#else
+	unsigned int b = 0;
+	while (v >>= 1) {
+		++b;
+	}
+	return b;
+#endif
+}
+
+static size_t opahistIndex(uint64_t v) {
+	if (v < OPAHIST_SUBCOUNT) {
+		return (size_t) v;
+	}
+	unsigned int msb = opahistMsb(v);
+	if (msb >= OPAHIST_MAXBITS) {
+		return OPAHIST_NUMBUCKETS - 1;
+	}
+	unsigned int shift = msb - OPAHIST_SUBBITS;
+	return ((size_t) (shift + 1) << OPAHIST_SUBBITS) + (size_t) ((v >> shift) & (OPAHIST_SUBCOUNT - 1));
+}
+
+// get the smallest value and the width of a bucket
+static uint64_t opahistBucketStart(size_t idx, uint64_t* pWidth) {
+	if (idx < OPAHIST_SUBCOUNT) {
+		*pWidth = 1;
+		return idx;
+	}
+	unsigned int shift = (unsigned int) (idx >> OPAHIST_SUBBITS) - 1;
+	*pWidth = ((uint64_t) 1) << shift;
+	return ((uint64_t) (OPAHIST_SUBCOUNT + (idx & (OPAHIST_SUBCOUNT - 1)))) << shift;
+}
+
+void opahistInit(opahist* h) {
+	memset(h, 0, sizeof(opahist));
+}
+
+void opahistRecord(opahist* h, uint64_t v) {
+	SASSERT(OPAHIST_SUBBITS > 0 && OPAHIST_SUBBITS < OPAHIST_MAXBITS && OPAHIST_MAXBITS < 64);
+	if (h->count == 0 || v < h->min) {
+		h->min = v;
+	}
+	if (v > h->max) {
+		h->max = v;
+	}
+	++h->count;
+	h->sum += v;
+	++h->buckets[opahistIndex(v)];
+}
+
+void opahistMerge(opahist* dst, const opahist* src) {
+	if (src->count == 0) {
+		return;
+	}
+	if (dst->count == 0 || src->min < dst->min) {
+		dst->min = src->min;
+	}
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (size_t i = 0; i < OPAHIST_NUMBUCKETS; ++i) {
+		dst->buckets[i] += src->buckets[i];
+	}
+}
+
+uint64_t opahistPercentile(const opahist* h, double p) {
+	if (h->count == 0) {
+		return 0;
+	}
+	if (p >= 100) {
+		return h->max;
+	}
+	double target = p <= 0 ? 1 : (p / 100) * (double) h->count;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < OPAHIST_NUMBUCKETS; ++i) {
+		seen += h->buckets[i];
+		if (h->buckets[i] != 0 && (double) seen >= target) {
+			uint64_t width;
+			uint64_t v = opahistBucketStart(i, &width);
+			v += (width - 1) / 2;
+			return v < h->min ? h->min : (v > h->max ? h->max : v);
+		}
+	}
+	return h->max;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPAHIST_H_
+#define OPAHIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// each power of 2 range is split into 2^OPAHIST_SUBBITS buckets of equal width (ie, 4 bits gives a
+//  relative error of about 3% when the middle of a bucket is reported)
+#ifndef OPAHIST_SUBBITS
+#define OPAHIST_SUBBITS 4
+#endif
+
+// values that need more bits than this are counted in the last bucket (40 bits of nanoseconds is about 18 minutes)
+#ifndef OPAHIST_MAXBITS
+#define OPAHIST_MAXBITS 40
+#endif
+
+#define OPAHIST_NUMBUCKETS ((OPAHIST_MAXBITS - OPAHIST_SUBBITS + 1) << OPAHIST_SUBBITS)
+
+/**
+ * Log-linear histogram: values below 2^OPAHIST_SUBBITS have their own bucket; larger values are grouped
+ * by their most significant bit and then by the next OPAHIST_SUBBITS bits.
+ */
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[OPAHIST_NUMBUCKETS];
+} opahist;
+
+void opahistInit(opahist* h);
+void opahistRecord(opahist* h, uint64_t v);
+
+/**
+ * Add the values recorded in src to dst
+ */
+void opahistMerge(opahist* dst, const opahist* src);
+
+/**
+ * Get the value at or below which p percent of the recorded values fall (ie, p=99.9). The middle of the
+ * bucket is returned (limited to the min and max recorded values).
+ * @return 0 if no values are recorded
+ */
+uint64_t opahistPercentile(const opahist* h, double p);
+
+#endif
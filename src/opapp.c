@@ -5,12 +5,9 @@
 
 #include <limits.h>
 
-#ifdef __SSE2__
-#include <emmintrin.h>
-#endif
-
 #include "opacore.h"
 #include "opapp.h"
+#include "opautf8.h"
 
 
 
@@ -38,10 +35,6 @@
 static uint8_t utf8check(const uint8_t* buff, size_t len, uint8_t state) {
 	const uint8_t* end = buff + len;
 
-//#ifdef __SSE2__
-//	const uint8_t* sseEnd = buff + len - 16;
-//#endif
-
 	switch (state) {
 		case UTF8FIRST: goto CHECKFIRST;
 		case UTF8NEED1: goto CHECKNEED1;
@@ -70,19 +63,9 @@ static uint8_t utf8check(const uint8_t* buff, size_t len, uint8_t state) {
 	// F4-F4 80-8F 80-BF 80-BF
 
 	CHECKFIRST:
-
-//#ifdef __SSE2__
-//	while (buff < sseEnd) {
-//		// skip in chunks of 16 bytes if MSB is not set (chars are ASCII)
-//		int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) buff));
-//		if (mask != 0) {
-//			// this chunk contains a non-ascii character
-//			buff += __builtin_ctz(mask);
-//			break;
-//		}
-//		buff += 16;
-//	}
-//#endif
+	// validate whole blocks with SIMD (or skip ascii chars); the bytes after the returned offset (an incomplete
+	//  char or a block with an error) are checked 1 at a time
+	buff += opautf8ValidPrefix(buff, end - buff);
 
 	while (buff < end) {
 		if (*buff <= 0x7F) {
@@ -152,11 +135,206 @@ static uint8_t utf8check(const uint8_t* buff, size_t len, uint8_t state) {
 #define OPAPP_S_ERR          8
 
 
+// record the start of an element at depth 0 (a new top level value) or depth 1. return 1 if an offset was added
+static int opappIndexElem(opapp* rc, unsigned int depth, const uint8_t* start, const uint8_t* elem) {
+	if (depth == 0) {
+		rc->indexLen = 0;
+	} else if (rc->indexLen < OPAPP_MAXINDEX) {
+		rc->index[rc->indexLen++] = rc->indexBase + (elem - start);
+		return 1;
+	}
+	return 0;
+}
+
+#define OPAPP_SCAN_PARTIAL 0 // value is not complete; resume at start of the element that is not complete
+#define OPAPP_SCAN_OK      1
+#define OPAPP_SCAN_ERR     2
+
+// read a varint that must be complete before end. note: buff must be null terminated (the null char stops the
+//  loop at end)
+static int opappScanVarint(const uint8_t** pBuff, const uint8_t* end, uint64_t* pVal) {
+	const uint8_t* buff = *pBuff;
+	if (buff < end && buff[0] < 0x80) {
+		*pVal = buff[0];
+		*pBuff = buff + 1;
+		return OPAPP_SCAN_OK;
+	}
+	uint64_t val = 0;
+	unsigned int i = 0;
+	while ((buff[i] & 0x80) != 0 && i < 9) {
+		val |= ((uint64_t) (buff[i] & 0x7F)) << (i * 7);
+		++i;
+	}
+	if (buff + i >= end) {
+		return OPAPP_SCAN_PARTIAL;
+	}
+	if (i >= 9 || (buff[i] == 0 && i > 0)) {
+		// varint must be encoded with 1-9 bytes
+		// varint cannot have 0 prefix (last byte cannot be zero for multi-byte varint)
+		return OPAPP_SCAN_ERR;
+	}
+	*pVal = val | (((uint64_t) (buff[i] & 0x7F)) << (i * 7));
+	*pBuff = buff + i + 1;
+	return OPAPP_SCAN_OK;
+}
+
+#define OPAPP_SCANVARINT(val) { \
+	int vres = opappScanVarint(&buff, end, &val); \
+	if (vres != OPAPP_SCAN_OK) { \
+		if (vres == OPAPP_SCAN_ERR) { \
+			return OPAPP_SCAN_ERR; \
+		} \
+		goto Partial; \
+	} \
+}
+
+// find the end of the value that starts at *pBuff (or continue the array that the parser is in) with all state
+//  in local variables. this is faster than the resumable state machine when the whole value is already in the
+//  buffer (ie, a small response). if an element is not complete then rc->arrayDepth is updated, *pBuff is set
+//  to the start of the element and the resumable state machine must parse the rest. the checks are the same as
+//  opappFindEndInternal()
+static int opappScan(opapp* rc, const uint8_t* start, const uint8_t** pBuff, const uint8_t* end, const opappOptions* opt) {
+	const uint8_t* buff = *pBuff;
+	const uint8_t* elem = buff;
+	unsigned int depth = rc->arrayDepth;
+	int indexed = 0;
+	uint64_t val;
+	while (1) {
+		elem = buff;
+		indexed = depth <= 1 && rc->trackIndex ? opappIndexElem(rc, depth, start, elem) : 0;
+		switch (*buff++) {
+			default:
+				// note: a null char at end is the end of the buffer
+				if (elem == end) {
+					goto Partial;
+				}
+				return OPAPP_SCAN_ERR;
+
+			case OPADEF_UNDEFINED:
+			case OPADEF_NULL:
+			case OPADEF_FALSE:
+			case OPADEF_TRUE:
+			case OPADEF_NEGINF:
+			case OPADEF_POSINF:
+			case OPADEF_ZERO:
+			case OPADEF_BIN_EMPTY:
+			case OPADEF_STR_EMPTY:
+			case OPADEF_ARRAY_EMPTY:
+			case OPADEF_SORTMAX:
+				break;
+
+			case OPADEF_POSVARINT:
+			case OPADEF_NEGVARINT:
+				OPAPP_SCANVARINT(val);
+				break;
+
+			case OPADEF_POSBIGINT:
+			case OPADEF_NEGBIGINT:
+				OPAPP_SCANVARINT(val);
+				goto BigIntBytes;
+
+			case OPADEF_POSPOSVARDEC:
+			case OPADEF_POSNEGVARDEC:
+			case OPADEF_NEGPOSVARDEC:
+			case OPADEF_NEGNEGVARDEC:
+				OPAPP_SCANVARINT(val);
+				if (val > opt->maxDecExp) {
+					return OPAPP_SCAN_ERR;
+				}
+				OPAPP_SCANVARINT(val);
+				break;
+
+			case OPADEF_POSPOSBIGDEC:
+			case OPADEF_POSNEGBIGDEC:
+			case OPADEF_NEGPOSBIGDEC:
+			case OPADEF_NEGNEGBIGDEC:
+				OPAPP_SCANVARINT(val);
+				if (val > opt->maxDecExp) {
+					return OPAPP_SCAN_ERR;
+				}
+				OPAPP_SCANVARINT(val);
+				goto BigIntBytes;
+
+			case OPADEF_BIN_LPVI:
+				OPAPP_SCANVARINT(val);
+				goto SkipBytes;
+
+			case OPADEF_STR_LPVI:
+				OPAPP_SCANVARINT(val);
+				if (val > (uint64_t) (end - buff)) {
+					goto Partial;
+				}
+				if (opt->checkUtf8 && utf8check(buff, val, UTF8FIRST) != UTF8FIRST) {
+					// invalid utf-8 bytes or last char is not complete
+					return OPAPP_SCAN_ERR;
+				}
+				buff += val;
+				break;
+
+			case OPADEF_ARRAY_START:
+				if (depth >= opt->maxArrayDepth) {
+					return OPAPP_SCAN_ERR;
+				}
+				++depth;
+				continue;
+
+			case OPADEF_ARRAY_END:
+				if (depth == 0) {
+					return OPAPP_SCAN_ERR;
+				}
+				--depth;
+				break;
+		}
+		goto NextElem;
+
+		BigIntBytes:
+		if (val == 0 || val > opt->maxBigIntLen) {
+			// bigint or bigdec significand has a byte-len of 0 (byte-len must be >0) or is too long
+			return OPAPP_SCAN_ERR;
+		}
+		if (buff >= end) {
+			goto Partial;
+		}
+		if (*buff == 0 && val > 1) {
+			// MSB cannot be 0 if byte-len is >1
+			return OPAPP_SCAN_ERR;
+		}
+
+		SkipBytes:
+		if (val > (uint64_t) (end - buff)) {
+			goto Partial;
+		}
+		buff += val;
+
+		NextElem:
+		if (depth == 0) {
+			rc->arrayDepth = 0;
+			rc->indexBase = 0;
+			*pBuff = buff;
+			return OPAPP_SCAN_OK;
+		}
+	}
+
+	Partial:
+	if (indexed) {
+		// the state machine records the element again
+		--rc->indexLen;
+	}
+	rc->arrayDepth = depth;
+	*pBuff = elem;
+	return OPAPP_SCAN_PARTIAL;
+}
+
 static int opappFindEndInternal(opapp* rc, const uint8_t* buff, size_t len, const uint8_t** pEnd, const opappOptions* opt) {
 	OASSERT(buff[len] == 0);
 
+	const uint8_t* start = buff;
 	const uint8_t* end = buff + len;
 
+	if (rc->state == OPAPP_S_NEXTOBJ) {
+		goto Scan;
+	}
+
 	StateSwitch: {
 		switch (rc->state) {
 			case OPAPP_S_NEXTOBJ:      goto ParseNextObj;
@@ -176,13 +354,32 @@ static int opappFindEndInternal(opapp* rc, const uint8_t* buff, size_t len, cons
 	ReturnOrParseNextObj: {
 		if (rc->arrayDepth == 0) {
 			rc->state = OPAPP_S_NEXTOBJ;
+			rc->indexBase = 0;
 			*pEnd = buff;
 			return 0;
 		}
-		goto ParseNextObj;
+		goto Scan;
+	}
+
+	Scan: {
+		// try to parse the rest of the value without saving state. fall back to the state machine at the start
+		//  of an element that is not complete
+		switch (opappScan(rc, start, &buff, end, opt)) {
+			case OPAPP_SCAN_OK:
+				rc->state = OPAPP_S_NEXTOBJ;
+				*pEnd = buff;
+				return 0;
+			case OPAPP_SCAN_PARTIAL:
+				goto ParseNextObj;
+			default:
+				goto ReturnParseErr;
+		}
 	}
 
 	ParseNextObj: {
+		if (rc->arrayDepth <= 1 && rc->trackIndex && buff < end) {
+			opappIndexElem(rc, rc->arrayDepth, start, buff);
+		}
 		switch (*buff++) {
 			default:
 			case 0:
@@ -251,6 +448,7 @@ static int opappFindEndInternal(opapp* rc, const uint8_t* buff, size_t len, cons
 				}
 				if (--rc->arrayDepth == 0) {
 					rc->state = OPAPP_S_NEXTOBJ;
+					rc->indexBase = 0;
 					*pEnd = buff;
 					return 0;
 				}
@@ -355,6 +553,7 @@ static int opappFindEndInternal(opapp* rc, const uint8_t* buff, size_t len, cons
 	}
 
 	ReturnOK: {
+		rc->indexBase += len;
 		*pEnd = NULL;
 		return 0;
 	}
@@ -372,3 +571,14 @@ static const opappOptions OPAPP_DEFOPT = {
 int opappFindEnd(opapp* rc, const uint8_t* buff, size_t len, const uint8_t** pEnd, const opappOptions* opt) {
 	return opappFindEndInternal(rc, buff, len, pEnd, opt == NULL ? &OPAPP_DEFOPT : opt);
 }
+
+uint64_t opappBytesRemaining(const opapp* rc) {
+	switch (rc->state) {
+		case OPAPP_S_UTF8:
+		case OPAPP_S_SKIPBYTES:
+		case OPAPP_S_CHECKBIBYTES:
+			return rc->varintVal;
+		default:
+			return 0;
+	}
+}
@@ -9,6 +9,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// max number of offsets that are recorded in opapp's index (ie, asyncid, result, error and the closing ']'
+//  of a response)
+#ifndef OPAPP_MAXINDEX
+#define OPAPP_MAXINDEX 4
+#endif
+
 typedef struct {
 	uint8_t state;
 	uint8_t utf8State;
@@ -16,6 +22,15 @@ typedef struct {
 	uint8_t varintLen;
 	unsigned int arrayDepth;
 	uint64_t varintVal;
+
+	// if trackIndex is set (by the caller) then the offsets of the elements of a top level array are recorded in
+	//  index while it is parsed, followed by the offset of the array's closing ']' (the index is complete when
+	//  opappFindEnd() returns the end of the array; only the first OPAPP_MAXINDEX offsets are kept). offsets are
+	//  from the first byte of the top level value even if it was passed to opappFindEnd() in several parts
+	char trackIndex;
+	uint8_t indexLen;
+	size_t indexBase;  // number of bytes of the current top level value that were passed in previous calls
+	size_t index[OPAPP_MAXINDEX];
 } opapp;
 
 typedef struct {
@@ -29,4 +44,10 @@ typedef struct {
 
 int opappFindEnd(opapp* rc, const uint8_t* buff, size_t len, const uint8_t** pEnd, const opappOptions* opt);
 
+/**
+ * Get the number of bytes that remain in the bin/str/bigint that is currently being parsed.
+ * Returns 0 if parser is not in the middle of one of those values.
+ */
+uint64_t opappBytesRemaining(const opapp* rc);
+
 #endif
@@ -6,29 +6,22 @@
 #include "opacore.h"
 #include "opaqueue.h"
 
-static void opaqueueLock(opaqueue* q) {
-	#ifndef OPA_NOTHREADS
-		if (q->sync) {
-			opamutexLock(&q->m);
-		}
-	#else
-		UNUSED(q);
-	#endif
-}
-
-static void opaqueueUnlock(opaqueue* q) {
-	#ifndef OPA_NOTHREADS
-		if (q->sync) {
-			opamutexLock(&q->m);
-		}
-	#else
-		UNUSED(q);
-	#endif
-}
+#ifndef OPA_NOTHREADS
+#ifdef _MSC_VER
+#define ATOMIC_XCHGPTR(p, v) InterlockedExchangePointer((PVOID volatile*) (p), (v))
+#define ATOMIC_CASPTR(p, expect, v) (InterlockedCompareExchangePointer((PVOID volatile*) (p), (v), (expect)) == (expect))
+#define ATOMIC_LOADPTR(p) (*(void* volatile*) (p))
+#elif defined(__GNUC__)
+#define ATOMIC_XCHGPTR(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQUIRE)
+#define ATOMIC_CASPTR(p, expect, v) __atomic_compare_exchange_n((p), &(expect), (v), 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define ATOMIC_LOADPTR(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#endif
+#endif
 
 void opaqueueInit(opaqueue* q) {
 	q->head = q->tail = NULL;
 	#ifndef OPA_NOTHREADS
+		q->inbox = NULL;
 		q->sync = 0;
 	#endif
 }
@@ -36,39 +29,85 @@ void opaqueueInit(opaqueue* q) {
 #ifndef OPA_NOTHREADS
 void opaqueueInitMT(opaqueue* q) {
 	opaqueueInit(q);
-	opamutexInit(&q->m);
 	q->sync = 1;
 }
 
 void opaqueueClose(opaqueue* q) {
-	if (q->sync) {
-		opamutexDestroy(&q->m);
+	UNUSED(q);
+}
+
+static int opaqueuePushMT(opaqueue* q, opaqueueItem* item) {
+	opaqueueItem* head;
+	do {
+		head = ATOMIC_LOADPTR(&q->inbox);
+		item->next = head;
+	} while (!ATOMIC_CASPTR(&q->inbox, head, item));
+	return head == NULL;
+}
+
+// make sure that items pushed by producers are in the consumer's list (if consumer's list is empty)
+static void opaqueueTakeInbox(opaqueue* q) {
+	if (q->head == NULL) {
+		if (ATOMIC_LOADPTR(&q->inbox) == NULL) {
+			return;
+		}
+		// take all pushed items and reverse them into the consumer's private list
+		opaqueueItem* i = ATOMIC_XCHGPTR(&q->inbox, NULL);
+		while (i != NULL) {
+			opaqueueItem* next = i->next;
+			i->next = q->head;
+			q->head = i;
+			i = next;
+		}
 	}
 }
+
+static opaqueueItem* opaqueuePollMT(opaqueue* q) {
+	opaqueueTakeInbox(q);
+	opaqueueItem* item = q->head;
+	if (item != NULL) {
+		q->head = item->next;
+	}
+	return item;
+}
 #endif
 
 int opaqueuePush(opaqueue* q, opaqueueItem* item) {
-	int empty;
+	#ifndef OPA_NOTHREADS
+		if (q->sync) {
+			return opaqueuePushMT(q, item);
+		}
+	#endif
 	item->next = NULL;
-	opaqueueLock(q);
 	if (q->head == NULL) {
 		q->head = item;
 		q->tail = item;
-		empty = 1;
+		return 1;
 	} else {
 		q->tail->next = item;
-		empty = 0;
+		q->tail = item;
+		return 0;
 	}
-	opaqueueUnlock(q);
-	return empty;
 }
 
 opaqueueItem* opaqueuePoll(opaqueue* q) {
-	opaqueueLock(q);
+	#ifndef OPA_NOTHREADS
+		if (q->sync) {
+			return opaqueuePollMT(q);
+		}
+	#endif
 	opaqueueItem* item = q->head;
 	if (item != NULL) {
 		q->head = item->next;
 	}
-	opaqueueUnlock(q);
 	return item;
 }
+
+opaqueueItem* opaqueuePeek(opaqueue* q) {
+	#ifndef OPA_NOTHREADS
+		if (q->sync) {
+			opaqueueTakeInbox(q);
+		}
+	#endif
+	return q->head;
+}
@@ -7,10 +7,6 @@
 #define OPAQUEUE_H_
 
 
-#ifndef OPA_NOTHREADS
-#include "opamutex.h"
-#endif
-
 typedef struct opaqueueItem_s {
 	struct opaqueueItem_s* next;
 } opaqueueItem;
@@ -19,11 +15,19 @@ typedef struct {
 	opaqueueItem* head;
 	opaqueueItem* tail;
 #ifndef OPA_NOTHREADS
-	opamutex m;
+	opaqueueItem* inbox; // MT only: items pushed by producers, newest first
 	char sync;
 #endif
 } opaqueue;
 
+/*
+ * A queue created with opaqueueInitMT() is lock-free: any number of threads can push but only 1 thread
+ * at a time can poll. Producers push onto a lock-free stack (1 CAS); the consumer takes the whole
+ * stack with 1 atomic exchange when its private list is empty and reverses it so items are polled in
+ * the order they were pushed. With a single producer the CAS only retries if the consumer took the
+ * stack at the same moment.
+ */
+
 void opaqueueInit(opaqueue* q);
 #ifndef OPA_NOTHREADS
 void opaqueueInitMT(opaqueue* q);
@@ -31,8 +35,11 @@ void opaqueueClose(opaqueue* q);
 #endif
 
 // returns 0 if queue was not empty; non-zero if queue was empty before modified
+// note: for MT queues, non-zero can also be returned if the consumer has items that it has not polled yet
 int opaqueuePush(opaqueue* q, opaqueueItem* item);
 opaqueueItem* opaqueuePoll(opaqueue* q);
+// return the item that the next call to opaqueuePoll() would return without removing it. consumer only
+opaqueueItem* opaqueuePeek(opaqueue* q);
 
 
 #endif
@@ -26,6 +26,7 @@ static void oparbAppend(oparb* rb, const void* src, size_t srcLen) {
 void oparbInit(oparb* rb, const uint8_t* asyncId, size_t idLen) {
 	opabuffInit(&rb->buff, 0);
 	rb->depth = 0;
+	rb->arrayStart = 0;
 	rb->err = 0;
 	rb->errDesc = NULL;
 	oparbAppend1(rb, OPADEF_ARRAY_START);
@@ -173,10 +174,32 @@ void oparbAddStr(oparb* rb, size_t len, const void* arg) {
 	oparbAppendStrOrBin(rb, len, arg, OPADEF_STR_LPVI);
 }
 
+static size_t oparbAppendHeader(oparb* rb, uint64_t len, uint8_t type) {
+	if (len == 0) {
+		oparbAppend1(rb, type == OPADEF_STR_LPVI ? OPADEF_STR_EMPTY : OPADEF_BIN_EMPTY);
+	} else if (len > INT64_MAX) {
+		if (!rb->err) {
+			rb->err = OPA_ERR_OVERFLOW;
+		}
+	} else {
+		oparbWriteVarint(rb, type, len);
+	}
+	return opabuffGetLen(&rb->buff);
+}
+
+size_t oparbAddBinHeader(oparb* rb, uint64_t len) {
+	return oparbAppendHeader(rb, len, OPADEF_BIN_LPVI);
+}
+
+size_t oparbAddStrHeader(oparb* rb, uint64_t len) {
+	return oparbAppendHeader(rb, len, OPADEF_STR_LPVI);
+}
+
 void oparbStartArray(oparb* rb) {
 	oparbAppend1(rb, OPADEF_ARRAY_START);
 	if (!rb->err) {
 		++rb->depth;
+		rb->arrayStart = opabuffGetLen(&rb->buff);
 	}
 }
 
@@ -190,8 +213,9 @@ void oparbStopArray(oparb* rb) {
 	}
 	if (!rb->err) {
 		OASSERT(opabuffGetLen(&rb->buff) > 0);
+		// note: last byte may be the last byte of a bin/str or varint that happens to match ARRAY_START
 		uint8_t* prevByte = opabuffGetPos(&rb->buff, opabuffGetLen(&rb->buff) - 1);
-		if (prevByte != NULL && *prevByte == OPADEF_ARRAY_START) {
+		if (opabuffGetLen(&rb->buff) == rb->arrayStart && *prevByte == OPADEF_ARRAY_START) {
 			*prevByte = OPADEF_ARRAY_EMPTY;
 		} else {
 			oparbAppend1(rb, OPADEF_ARRAY_END);
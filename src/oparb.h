@@ -13,6 +13,7 @@
 typedef struct {
 	opabuff buff;         // buff containing raw request
 	unsigned int depth;
+	size_t arrayStart;    // length of buff after the last array start was added (to detect an empty array)
 	int err;              // error code that occurred while building request (ie, out of memory)
 	const char* errDesc;  // description of error that occurred while building request (may be NULL even if err is nonzero)
 } oparb;
@@ -24,6 +25,14 @@ void oparbAddSO(oparb* rb, const uint8_t* so);
 void oparbAddNumStr(oparb* rb, const char* s, const char* end);
 void oparbAddBin(oparb* rb, size_t len, const void* arg);
 void oparbAddStr(oparb* rb, size_t len, const void* arg);
+
+/**
+ * Add the header of a bin/str argument without its bytes. The bytes must be inserted when the request is
+ * sent (see opacReqAddStream).
+ * @return offset in rb->buff where the bytes of the argument are inserted
+ */
+size_t oparbAddBinHeader(oparb* rb, uint64_t len);
+size_t oparbAddStrHeader(oparb* rb, uint64_t len);
 void oparbStartArray(oparb* rb);
 void oparbStopArray(oparb* rb);
 void oparbFinish(oparb* rb);
@@ -0,0 +1,587 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "opacore.h"
+#include "opasoreader.h"
+
+
+// same rules as opaviLoadWithErr() but the varint must end before end
+static int opasoReaderVarint(const uint8_t* p, const uint8_t* end, uint64_t* pVal, const uint8_t** pNext) {
+	if (end - p >= OPAVI_MAXLEN64) {
+		// opaviLoadWithErr() cannot read past end
+		return opaviLoadWithErr(p, pVal, pNext) ? OPA_ERR_PARSE : 0;
+	}
+	uint64_t val = 0;
+	for (unsigned int shift = 0; p < end; shift += 7) {
+		uint8_t b = *p++;
+		if (shift == 63 && b > 1) {
+			// varint too big
+			return OPA_ERR_PARSE;
+		}
+		val |= ((uint64_t) (b & 0x7F)) << shift;
+		if (!(b & 0x80)) {
+			if (b == 0 && shift > 0) {
+				// invalid varint MSB
+				return OPA_ERR_PARSE;
+			}
+			*pVal = val;
+			*pNext = p;
+			return 0;
+		}
+	}
+	return OPA_ERR_PARSE;
+}
+
+// varint length followed by that many bytes
+static int opasoReaderLenPrefixed(const uint8_t* p, const uint8_t* end, const uint8_t** pStart, size_t* pLen) {
+	uint64_t len;
+	int err = opasoReaderVarint(p, end, &len, &p);
+	if (!err && len > (uint64_t) (end - p)) {
+		err = OPA_ERR_PARSE;
+	}
+	if (!err) {
+		*pStart = p;
+		*pLen = len;
+	}
+	return err;
+}
+
+// find the end of a scalar (or the start of an array) at p
+static int opasoReaderTokenEnd(const uint8_t* p, const uint8_t* end, const uint8_t** pNext) {
+	uint64_t tmp;
+	const uint8_t* start;
+	size_t len;
+	int err;
+	switch (*p) {
+		case OPADEF_UNDEFINED:
+		case OPADEF_NULL:
+		case OPADEF_FALSE:
+		case OPADEF_TRUE:
+		case OPADEF_NEGINF:
+		case OPADEF_POSINF:
+		case OPADEF_ZERO:
+		case OPADEF_SORTMAX:
+		case OPADEF_BIN_EMPTY:
+		case OPADEF_STR_EMPTY:
+		case OPADEF_ARRAY_EMPTY:
+		case OPADEF_ARRAY_START:
+		case OPADEF_ARRAY_END:
+			*pNext = p + 1;
+			return 0;
+
+		case OPADEF_POSVARINT:
+		case OPADEF_NEGVARINT:
+			return opasoReaderVarint(p + 1, end, &tmp, pNext);
+
+		case OPADEF_BIN_LPVI:
+		case OPADEF_STR_LPVI:
+		case OPADEF_POSBIGINT:
+		case OPADEF_NEGBIGINT:
+			err = opasoReaderLenPrefixed(p + 1, end, &start, &len);
+			if (!err) {
+				*pNext = start + len;
+			}
+			return err;
+
+		case OPADEF_POSPOSVARDEC:
+		case OPADEF_POSNEGVARDEC:
+		case OPADEF_NEGPOSVARDEC:
+		case OPADEF_NEGNEGVARDEC:
+			err = opasoReaderVarint(p + 1, end, &tmp, &p);
+			return err ? err : opasoReaderVarint(p, end, &tmp, pNext);
+
+		case OPADEF_POSPOSBIGDEC:
+		case OPADEF_POSNEGBIGDEC:
+		case OPADEF_NEGPOSBIGDEC:
+		case OPADEF_NEGNEGBIGDEC:
+			err = opasoReaderVarint(p + 1, end, &tmp, &p);
+			if (!err) {
+				err = opasoReaderLenPrefixed(p, end, &start, &len);
+			}
+			if (!err) {
+				*pNext = start + len;
+			}
+			return err;
+	}
+	return OPA_ERR_PARSE;
+}
+
+// find the end of the element at p (which must be before end)
+static int opasoReaderElemEnd(const uint8_t* p, const uint8_t* end, const uint8_t** pNext) {
+	size_t depth = 0;
+	do {
+		if (p >= end) {
+			return OPA_ERR_PARSE;
+		}
+		if (*p == OPADEF_ARRAY_START) {
+			++depth;
+		} else if (*p == OPADEF_ARRAY_END) {
+			if (depth == 0) {
+				return OPA_ERR_PARSE;
+			}
+			--depth;
+		}
+		int err = opasoReaderTokenEnd(p, end, &p);
+		if (err) {
+			return err;
+		}
+	} while (depth > 0);
+	*pNext = p;
+	return 0;
+}
+
+void opasoReaderInit(opasoReader* r, const uint8_t* buff, size_t len) {
+	r->pos = buff;
+	r->end = buff + len;
+	r->depth = 0;
+	r->inEmpty = 0;
+}
+
+int opasoReaderHasNext(const opasoReader* r) {
+	return !r->inEmpty && r->pos < r->end && (r->depth == 0 || *r->pos != OPADEF_ARRAY_END);
+}
+
+uint8_t opasoReaderPeekType(const opasoReader* r) {
+	return opasoReaderHasNext(r) ? *r->pos : 0;
+}
+
+int opasoReaderEnterArray(opasoReader* r) {
+	if (!opasoReaderHasNext(r)) {
+		return OPA_ERR_EOF;
+	}
+	if (*r->pos == OPADEF_ARRAY_EMPTY) {
+		r->inEmpty = 1;
+	} else if (*r->pos != OPADEF_ARRAY_START) {
+		return OPA_ERR_INVARG;
+	}
+	++r->pos;
+	++r->depth;
+	return 0;
+}
+
+int opasoReaderExitArray(opasoReader* r) {
+	if (r->depth == 0) {
+		return OPA_ERR_INVSTATE;
+	}
+	if (r->inEmpty) {
+		r->inEmpty = 0;
+		--r->depth;
+		return 0;
+	}
+	const uint8_t* p = r->pos;
+	while (p < r->end && *p != OPADEF_ARRAY_END) {
+		int err = opasoReaderElemEnd(p, r->end, &p);
+		if (err) {
+			return err;
+		}
+	}
+	if (p >= r->end) {
+		return OPA_ERR_PARSE;
+	}
+	r->pos = p + 1;
+	--r->depth;
+	return 0;
+}
+
+int opasoReaderSkip(opasoReader* r) {
+	if (!opasoReaderHasNext(r)) {
+		return OPA_ERR_EOF;
+	}
+	return opasoReaderElemEnd(r->pos, r->end, &r->pos);
+}
+
+int opasoReaderReadRaw(opasoReader* r, const uint8_t** pObj, size_t* pLen) {
+	const uint8_t* start = r->pos;
+	int err = opasoReaderSkip(r);
+	if (!err) {
+		*pObj = start;
+		*pLen = r->pos - start;
+	}
+	return err;
+}
+
+int opasoReaderReadBool(opasoReader* r, int* pVal) {
+	if (!opasoReaderHasNext(r)) {
+		return OPA_ERR_EOF;
+	}
+	if (*r->pos != OPADEF_TRUE && *r->pos != OPADEF_FALSE) {
+		return OPA_ERR_INVARG;
+	}
+	*pVal = *r->pos == OPADEF_TRUE;
+	++r->pos;
+	return 0;
+}
+
+// load a big-endian bigint magnitude with a varint length prefix
+static int opasoReaderBigMag(const uint8_t* p, const uint8_t* end, uint64_t* pMag, const uint8_t** pNext) {
+	const uint8_t* start;
+	size_t len;
+	int err = opasoReaderLenPrefixed(p, end, &start, &len);
+	if (err) {
+		return err;
+	}
+	const uint8_t* stop = start + len;
+	while (start < stop && *start == 0) {
+		++start;
+	}
+	if (stop - start > 8) {
+		return OPA_ERR_OVERFLOW;
+	}
+	uint64_t mag = 0;
+	for (; start < stop; ++start) {
+		mag = (mag << 8) | *start;
+	}
+	*pMag = mag;
+	*pNext = stop;
+	return 0;
+}
+
+static int opasoReaderExponent(const uint8_t* p, const uint8_t* end, int isNeg, int32_t* pExp, const uint8_t** pNext) {
+	uint64_t exp;
+	int err = opasoReaderVarint(p, end, &exp, pNext);
+	if (!err && exp > (isNeg ? (uint64_t) INT32_MAX + 1 : (uint64_t) INT32_MAX)) {
+		// opabigdecLoadSO() cannot load this either
+		err = OPA_ERR_OVERFLOW;
+	}
+	if (!err) {
+		*pExp = isNeg ? (int32_t) 0 - (int32_t) exp : (int32_t) exp;
+	}
+	return err;
+}
+
+// load the number at the cursor as (-1)^isNeg * mag * 10^exp; inf is -1 or 1 if the number is infinite
+static int opasoReaderNum(const opasoReader* r, uint64_t* pMag, int* pIsNeg, int32_t* pExp, int* pInf, const uint8_t** pNext) {
+	if (!opasoReaderHasNext(r)) {
+		return OPA_ERR_EOF;
+	}
+	const uint8_t* p = r->pos;
+	const uint8_t* end = r->end;
+	uint8_t type = *p++;
+	*pMag = 0;
+	*pIsNeg = 0;
+	*pExp = 0;
+	*pInf = 0;
+	switch (type) {
+		case OPADEF_NEGINF:
+		case OPADEF_POSINF:
+			*pInf = type == OPADEF_NEGINF ? -1 : 1;
+			*pNext = p;
+			return 0;
+		case OPADEF_ZERO:
+			*pNext = p;
+			return 0;
+
+		case OPADEF_NEGVARINT:
+			*pIsNeg = 1;
+			// fall through
+		case OPADEF_POSVARINT:
+			return opasoReaderVarint(p, end, pMag, pNext);
+
+		case OPADEF_NEGBIGINT:
+			*pIsNeg = 1;
+			// fall through
+		case OPADEF_POSBIGINT:
+			return opasoReaderBigMag(p, end, pMag, pNext);
+
+		case OPADEF_POSPOSVARDEC:
+		case OPADEF_POSNEGVARDEC:
+		case OPADEF_NEGPOSVARDEC:
+		case OPADEF_NEGNEGVARDEC: {
+			int err = opasoReaderExponent(p, end, type == OPADEF_NEGPOSVARDEC || type == OPADEF_NEGNEGVARDEC, pExp, &p);
+			*pIsNeg = type == OPADEF_POSNEGVARDEC || type == OPADEF_NEGNEGVARDEC;
+			return err ? err : opasoReaderVarint(p, end, pMag, pNext);
+		}
+
+		case OPADEF_POSPOSBIGDEC:
+		case OPADEF_POSNEGBIGDEC:
+		case OPADEF_NEGPOSBIGDEC:
+		case OPADEF_NEGNEGBIGDEC: {
+			int err = opasoReaderExponent(p, end, type == OPADEF_NEGPOSBIGDEC || type == OPADEF_NEGNEGBIGDEC, pExp, &p);
+			*pIsNeg = type == OPADEF_POSNEGBIGDEC || type == OPADEF_NEGNEGBIGDEC;
+			return err ? err : opasoReaderBigMag(p, end, pMag, pNext);
+		}
+	}
+	return OPA_ERR_INVARG;
+}
+
+// read an integer as a magnitude and sign
+static int opasoReaderIntMag(opasoReader* r, uint64_t* pMag, int* pIsNeg, const uint8_t** pNext) {
+	uint64_t mag;
+	int32_t exp;
+	int inf;
+	int err = opasoReaderNum(r, &mag, pIsNeg, &exp, &inf, pNext);
+	if (err) {
+		return err;
+	}
+	if (inf) {
+		return OPA_ERR_OVERFLOW;
+	}
+	for (; exp > 0 && mag != 0; --exp) {
+		if (mag > UINT64_MAX / 10) {
+			return OPA_ERR_OVERFLOW;
+		}
+		mag *= 10;
+	}
+	for (; exp < 0 && mag != 0; ++exp) {
+		if (mag % 10 != 0) {
+			// not an integer
+			return OPA_ERR_INVARG;
+		}
+		mag /= 10;
+	}
+	*pMag = mag;
+	return 0;
+}
+
+int opasoReaderReadInt64(opasoReader* r, int64_t* pVal) {
+	uint64_t mag;
+	int isNeg;
+	const uint8_t* next;
+	int err = opasoReaderIntMag(r, &mag, &isNeg, &next);
+	if (!err && mag > (uint64_t) INT64_MAX + (isNeg ? 1 : 0)) {
+		err = OPA_ERR_OVERFLOW;
+	}
+	if (!err) {
+		*pVal = !isNeg ? (int64_t) mag : (mag == (uint64_t) INT64_MAX + 1 ? INT64_MIN : -((int64_t) mag));
+		r->pos = next;
+	}
+	return err;
+}
+
+int opasoReaderReadUint64(opasoReader* r, uint64_t* pVal) {
+	uint64_t mag;
+	int isNeg;
+	const uint8_t* next;
+	int err = opasoReaderIntMag(r, &mag, &isNeg, &next);
+	if (!err && isNeg && mag != 0) {
+		err = OPA_ERR_OVERFLOW;
+	}
+	if (!err) {
+		*pVal = mag;
+		r->pos = next;
+	}
+	return err;
+}
+
+int opasoReaderReadDouble(opasoReader* r, double* pVal) {
+	static const double POW10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	uint64_t mag;
+	int isNeg;
+	int32_t exp;
+	int inf;
+	const uint8_t* next;
+	int err = opasoReaderNum(r, &mag, &isNeg, &exp, &inf, &next);
+	if (err) {
+		return err;
+	}
+	double val;
+	if (inf) {
+		val = inf < 0 ? -INFINITY : INFINITY;
+	} else if (mag == 0) {
+		// numbers have no negative zero (ie, OPADEF_NEGVARINT 0x00 is 0); same as the integer paths of the decoders
+		val = 0;
+	} else if (FLT_EVAL_METHOD == 0 && mag <= (1ULL << 53) && exp >= -22 && exp <= 22) {
+		// significand and power of 10 are both exact; a single multiply or divide is correctly rounded
+		val = exp >= 0 ? (double) mag * POW10[exp] : (double) mag / POW10[-exp];
+		val = isNeg ? -val : val;
+	} else {
+		// let strtod() do the correct rounding. note: there's no decimal point so the locale does not matter
+		char tmp[48];
+		opa_snprintf(tmp, sizeof(tmp), "%s%llue%ld", isNeg ? "-" : "", (unsigned long long) mag, (long) exp);
+		errno = 0;
+		val = strtod(tmp, NULL);
+		if (errno == ERANGE && isinf(val)) {
+			return OPA_ERR_OVERFLOW;
+		}
+	}
+	*pVal = val;
+	r->pos = next;
+	return 0;
+}
+
+static int opasoReaderStrOrBin(opasoReader* r, uint8_t lpviType, uint8_t emptyType, const uint8_t** pStr, size_t* pLen) {
+	if (!opasoReaderHasNext(r)) {
+		return OPA_ERR_EOF;
+	}
+	if (*r->pos == emptyType) {
+		*pStr = NULL;
+		*pLen = 0;
+		++r->pos;
+		return 0;
+	} else if (*r->pos != lpviType) {
+		return OPA_ERR_INVARG;
+	}
+	const uint8_t* start;
+	size_t len;
+	int err = opasoReaderLenPrefixed(r->pos + 1, r->end, &start, &len);
+	if (!err) {
+		*pStr = start;
+		*pLen = len;
+		r->pos = start + len;
+	}
+	return err;
+}
+
+int opasoReaderReadStr(opasoReader* r, const uint8_t** pStr, size_t* pLen) {
+	return opasoReaderStrOrBin(r, OPADEF_STR_LPVI, OPADEF_STR_EMPTY, pStr, pLen);
+}
+
+int opasoReaderReadBin(opasoReader* r, const uint8_t** pBin, size_t* pLen) {
+	return opasoReaderStrOrBin(r, OPADEF_BIN_LPVI, OPADEF_BIN_EMPTY, pBin, pLen);
+}
+
+// the element at the cursor is an integer that is stored in 1 or 2 bytes (most small integers)
+static int opasoReaderSmallInt(const opasoReader* r, int64_t* pVal) {
+	const uint8_t* p = r->pos;
+	if (*p == OPADEF_ZERO) {
+		*pVal = 0;
+		return 1;
+	} else if ((*p == OPADEF_POSVARINT || *p == OPADEF_NEGVARINT) && r->end - p >= 2 && p[1] < 0x80) {
+		*pVal = *p == OPADEF_POSVARINT ? p[1] : -((int64_t) p[1]);
+		return 1;
+	}
+	return 0;
+}
+
+#ifdef __SSE2__
+
+// decode up to 8 elements that are 1 byte varints (OPADEF_POSVARINT or OPADEF_NEGVARINT followed by a byte
+//  less than 0x80) from 16 bytes. each element is a 16 bit lane: type in the low byte, value in the high byte.
+//  all 8 lanes are returned as 2 vectors of 4 int32; the return value is the number of leading lanes that are
+//  valid elements
+static unsigned int opasoReaderSmallInts8(const uint8_t* p, __m128i* pLo, __m128i* pHi) {
+	__m128i in = _mm_loadu_si128((const __m128i*) (const void*) p);
+	__m128i types = _mm_and_si128(in, _mm_set1_epi16(0xFF));
+	__m128i isNeg = _mm_cmpeq_epi16(types, _mm_set1_epi16(OPADEF_NEGVARINT));
+	__m128i isInt = _mm_or_si128(isNeg, _mm_cmpeq_epi16(types, _mm_set1_epi16(OPADEF_POSVARINT)));
+	// the value's MSB is the lane's sign bit
+	__m128i ok = _mm_andnot_si128(_mm_srai_epi16(in, 15), isInt);
+	unsigned int valid = (unsigned int) __builtin_ctz(~_mm_movemask_epi8(ok) | 0x10000) / 2;
+	if (valid == 0) {
+		return 0;
+	}
+	__m128i v = _mm_srli_epi16(in, 8);
+	v = _mm_sub_epi16(_mm_xor_si128(v, isNeg), isNeg);
+	__m128i sign = _mm_srai_epi16(v, 15);
+	*pLo = _mm_unpacklo_epi16(v, sign);
+	*pHi = _mm_unpackhi_epi16(v, sign);
+	return valid;
+}
+
+static void opasoReaderStoreI64x4(int64_t* dst, __m128i v) {
+	__m128i sign = _mm_srai_epi32(v, 31);
+	_mm_storeu_si128((__m128i*) (void*) dst, _mm_unpacklo_epi32(v, sign));
+	_mm_storeu_si128((__m128i*) (void*) (dst + 2), _mm_unpackhi_epi32(v, sign));
+}
+
+static void opasoReaderStoreF64x4(double* dst, __m128i v) {
+	_mm_storeu_pd(dst, _mm_cvtepi32_pd(v));
+	_mm_storeu_pd(dst + 2, _mm_cvtepi32_pd(_mm_unpackhi_epi64(v, v)));
+}
+
+#endif
+
+// handle an element that could not be decoded: flag it (and skip it) or stop
+static int opasoReaderDecodeFail(opasoReader* r, int err, uint8_t* flags, size_t i) {
+	if (flags == NULL || (err != OPA_ERR_INVARG && err != OPA_ERR_OVERFLOW)) {
+		return err;
+	}
+	flags[i] = 1;
+	return opasoReaderSkip(r);
+}
+
+int opasoReaderDecodeI64Array(opasoReader* r, int64_t* vals, size_t maxVals, uint8_t* flags, size_t* pCount) {
+	int err = 0;
+	size_t i = 0;
+	while (i < maxVals && opasoReaderHasNext(r)) {
+#ifdef __SSE2__
+		__m128i lo, hi;
+		unsigned int n;
+		// all 8 lanes are stored (there's room) but only the valid ones are counted
+		if (maxVals - i >= 8 && r->end - r->pos >= 16 && (n = opasoReaderSmallInts8(r->pos, &lo, &hi)) > 0) {
+			opasoReaderStoreI64x4(vals + i, lo);
+			opasoReaderStoreI64x4(vals + i + 4, hi);
+			if (flags != NULL) {
+				memset(flags + i, 0, n);
+			}
+			r->pos += n * 2;
+			i += n;
+			continue;
+		}
+#endif
+		if (opasoReaderSmallInt(r, vals + i)) {
+			r->pos += *r->pos == OPADEF_ZERO ? 1 : 2;
+			err = 0;
+		} else {
+			err = opasoReaderReadInt64(r, vals + i);
+		}
+		if (err) {
+			vals[i] = 0;
+			err = opasoReaderDecodeFail(r, err, flags, i);
+			if (err) {
+				break;
+			}
+		} else if (flags != NULL) {
+			flags[i] = 0;
+		}
+		++i;
+	}
+	*pCount = i;
+	return err;
+}
+
+int opasoReaderDecodeF64Array(opasoReader* r, double* vals, size_t maxVals, uint8_t* flags, size_t* pCount) {
+	int err = 0;
+	size_t i = 0;
+	while (i < maxVals && opasoReaderHasNext(r)) {
+#ifdef __SSE2__
+		__m128i lo, hi;
+		unsigned int n;
+		if (maxVals - i >= 8 && r->end - r->pos >= 16 && (n = opasoReaderSmallInts8(r->pos, &lo, &hi)) > 0) {
+			opasoReaderStoreF64x4(vals + i, lo);
+			opasoReaderStoreF64x4(vals + i + 4, hi);
+			if (flags != NULL) {
+				memset(flags + i, 0, n);
+			}
+			r->pos += n * 2;
+			i += n;
+			continue;
+		}
+#endif
+		int64_t small;
+		if (opasoReaderSmallInt(r, &small)) {
+			vals[i] = (double) small;
+			r->pos += *r->pos == OPADEF_ZERO ? 1 : 2;
+			err = 0;
+		} else {
+			err = opasoReaderReadDouble(r, vals + i);
+		}
+		if (err) {
+			vals[i] = 0;
+			err = opasoReaderDecodeFail(r, err, flags, i);
+			if (err) {
+				break;
+			}
+		} else if (flags != NULL) {
+			flags[i] = 0;
+		}
+		++i;
+	}
+	*pCount = i;
+	return err;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPASOREADER_H_
+#define OPASOREADER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Cursor over a sequence of serialized objects. Every read is bounds-checked against the length passed to
+// opasoReaderInit() and nothing is allocated: strings and blobs are returned as pointers into the buffer.
+// When a function returns an error, the cursor does not move (ie, if opasoReaderReadInt64() returns
+// OPA_ERR_OVERFLOW then the caller can get the value's bytes with opasoReaderReadRaw() and load it with
+// opabigdecLoadSO()). Errors:
+//   OPA_ERR_EOF      - no element at the cursor (end of the buffer or end of the current array)
+//   OPA_ERR_INVARG   - element is not the requested type (or a number is not an integer for an integer read)
+//   OPA_ERR_OVERFLOW - number does not fit in the requested type
+//   OPA_ERR_PARSE    - element is invalid or extends past the end of the buffer
+//   OPA_ERR_INVSTATE - opasoReaderExitArray() was called when no array was entered
+// Strings are not checked for valid UTF-8 (the parser already checks responses received by opac).
+// A response from opacReqGetResponse() was validated when it was parsed, so it can be read with:
+//   opasoReaderInit(&rd, so, opasolen(so));
+typedef struct {
+	const uint8_t* pos;
+	const uint8_t* end;
+	unsigned int depth; // number of arrays that have been entered and not exited
+	char inEmpty;       // innermost array that was entered is empty (OPADEF_ARRAY_EMPTY has no end marker)
+} opasoReader;
+
+void opasoReaderInit(opasoReader* r, const uint8_t* buff, size_t len);
+
+/**
+ * @return non-zero if there is an element at the cursor; 0 at the end of the buffer or current array
+ */
+int opasoReaderHasNext(const opasoReader* r);
+
+/**
+ * @return type of the element at the cursor (OPADEF_*) or 0 if opasoReaderHasNext() would return 0
+ */
+uint8_t opasoReaderPeekType(const opasoReader* r);
+
+/**
+ * Move the cursor to the first element of the array at the cursor (OPADEF_ARRAY_START or OPADEF_ARRAY_EMPTY)
+ */
+int opasoReaderEnterArray(opasoReader* r);
+
+/**
+ * Skip the remaining elements of the current array and move the cursor past its end
+ */
+int opasoReaderExitArray(opasoReader* r);
+
+/**
+ * Move the cursor past the element at the cursor. Nested arrays are walked without recursion
+ */
+int opasoReaderSkip(opasoReader* r);
+
+/**
+ * Read the serialized bytes of the element at the cursor (including nested elements if it is an array)
+ */
+int opasoReaderReadRaw(opasoReader* r, const uint8_t** pObj, size_t* pLen);
+
+int opasoReaderReadBool(opasoReader* r, int* pVal);
+
+/**
+ * Read a number that is an integer. Decimals are accepted if their value is an integer (ie, 1.0 or 2e3).
+ * Infinity and values outside the range of the type return OPA_ERR_OVERFLOW
+ */
+int opasoReaderReadInt64(opasoReader* r, int64_t* pVal);
+int opasoReaderReadUint64(opasoReader* r, uint64_t* pVal);
+
+/**
+ * Read a number as the nearest double. Bigints and bigdecs with a significand larger than 64 bits and
+ * values larger than DBL_MAX return OPA_ERR_OVERFLOW. A zero is always +0.0 (even if it has a negative sign)
+ */
+int opasoReaderReadDouble(opasoReader* r, double* pVal);
+
+/**
+ * Read a string (OPADEF_STR_LPVI or OPADEF_STR_EMPTY) or blob (OPADEF_BIN_LPVI or OPADEF_BIN_EMPTY). The
+ * pointer is into the buffer; it is NULL if the length is 0
+ */
+int opasoReaderReadStr(opasoReader* r, const uint8_t** pStr, size_t* pLen);
+int opasoReaderReadBin(opasoReader* r, const uint8_t** pBin, size_t* pLen);
+
+/**
+ * Decode numbers from the current array into a contiguous array. Decoding stops at the end of the current
+ * array (or buffer) or after maxVals elements; call opasoReaderEnterArray() first and opasoReaderExitArray()
+ * after the last call (call again while opasoReaderHasNext() to decode an array in chunks). Elements are
+ * read like opasoReaderReadInt64() or opasoReaderReadDouble(). Runs of small integers (1 byte varints) are
+ * decoded 8 at a time with SSE2.
+ * @param flags If not NULL, flags[i] is set to 1 if element i is not a number or does not fit (vals[i] is
+ *              set to 0 and decoding continues) and 0 otherwise. If NULL, decoding stops at that element and
+ *              its error is returned
+ * @param pCount Set to the number of elements that were decoded (even if an error is returned); the cursor
+ *               is after the last decoded element
+ */
+int opasoReaderDecodeI64Array(opasoReader* r, int64_t* vals, size_t maxVals, uint8_t* flags, size_t* pCount);
+int opasoReaderDecodeF64Array(opasoReader* r, double* vals, size_t maxVals, uint8_t* flags, size_t* pCount);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OPAUTF8_AVX2
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define OPAUTF8_SSSE3
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "opacore.h"
+#include "opautf8.h"
+
+
+// return offset of the start of the character that contains p (p is at a character boundary unless one of the
+//  3 bytes before it is the start of a multi-byte character that is not complete)
+static size_t opautf8Boundary(const uint8_t* s, const uint8_t* p) {
+	if (p - s >= 1 && p[-1] >= 0xC0) {
+		return p - s - 1;
+	}
+	if (p - s >= 2 && p[-2] >= 0xE0) {
+		return p - s - 2;
+	}
+	if (p - s >= 3 && p[-3] >= 0xF0) {
+		return p - s - 3;
+	}
+	return p - s;
+}
+
+#if defined(OPAUTF8_AVX2) || defined(OPAUTF8_SSSE3)
+
+// "Validating UTF-8 In Less Than One Instruction Per Byte" (John Keiser, Daniel Lemire): each byte is
+//  classified by looking up the high nibble of the previous byte, the low nibble of the previous byte and
+//  the high nibble of the current byte in 3 tables. the AND of the results is non-zero if the pair of bytes
+//  is invalid. the 3rd and 4th bytes of a character are checked by comparing the bytes 2 and 3 positions
+//  back with 0xE0 and 0xF0
+
+#define TOO_SHORT  (1 << 0) // 11______ 0_______ or 11______ 11______
+#define TOO_LONG   (1 << 1) // 0_______ 10______
+#define OVERLONG_3 (1 << 2) // 11100000 100_____
+#define TOO_LARGE  (1 << 3) // 11110100 1001____ or 11110100 101_____ or 11110101..11111111 10______
+#define SURROGATE  (1 << 4) // 11101101 101_____
+#define OVERLONG_2 (1 << 5) // 1100000_ 10______
+#define TOO_LARGE_1000 (1 << 6) // 11110101..11111111 1000____
+#define OVERLONG_4 (1 << 6) // 11110000 1000____
+#define TWO_CONTS  (1 << 7) // 10______ 10______
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define C(x) ((char) (x))
+
+#define OPAUTF8_BYTE1HIGH \
+	C(TOO_LONG), C(TOO_LONG), C(TOO_LONG), C(TOO_LONG), \
+	C(TOO_LONG), C(TOO_LONG), C(TOO_LONG), C(TOO_LONG), \
+	C(TWO_CONTS), C(TWO_CONTS), C(TWO_CONTS), C(TWO_CONTS), \
+	C(TOO_SHORT | OVERLONG_2), \
+	C(TOO_SHORT), \
+	C(TOO_SHORT | OVERLONG_3 | SURROGATE), \
+	C(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)
+
+#define OPAUTF8_BYTE1LOW \
+	C(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4), \
+	C(CARRY | OVERLONG_2), \
+	C(CARRY), \
+	C(CARRY), \
+	C(CARRY | TOO_LARGE), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+	C(CARRY | TOO_LARGE | TOO_LARGE_1000)
+
+#define OPAUTF8_BYTE2HIGH \
+	C(TOO_SHORT), C(TOO_SHORT), C(TOO_SHORT), C(TOO_SHORT), \
+	C(TOO_SHORT), C(TOO_SHORT), C(TOO_SHORT), C(TOO_SHORT), \
+	C(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4), \
+	C(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE), \
+	C(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE), \
+	C(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE), \
+	C(TOO_SHORT), C(TOO_SHORT), C(TOO_SHORT), C(TOO_SHORT)
+
+// a block that ends with 1 of these bytes (or higher) at the last 3 positions ends in the middle of a character
+#define OPAUTF8_MAXLAST3 C(0xF0 - 1), C(0xE0 - 1), C(0xC0 - 1)
+#define OPAUTF8_FF4 C(0xFF), C(0xFF), C(0xFF), C(0xFF)
+
+#endif
+
+#ifdef OPAUTF8_AVX2
+
+// bytes of in shifted by n positions; the first n bytes are the last bytes of prev
+#define OPAUTF8_PREV(in, prev, n) _mm256_alignr_epi8(in, _mm256_permute2x128_si256(prev, in, 0x21), 16 - (n))
+
+size_t opautf8ValidPrefix(const uint8_t* s, size_t len) {
+	const __m256i byte1High = _mm256_setr_epi8(OPAUTF8_BYTE1HIGH, OPAUTF8_BYTE1HIGH);
+	const __m256i byte1Low = _mm256_setr_epi8(OPAUTF8_BYTE1LOW, OPAUTF8_BYTE1LOW);
+	const __m256i byte2High = _mm256_setr_epi8(OPAUTF8_BYTE2HIGH, OPAUTF8_BYTE2HIGH);
+	const __m256i maxLast = _mm256_setr_epi8(OPAUTF8_FF4, OPAUTF8_FF4, OPAUTF8_FF4, OPAUTF8_FF4, OPAUTF8_FF4, OPAUTF8_FF4, OPAUTF8_FF4, C(0xFF), OPAUTF8_MAXLAST3);
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const uint8_t* p = s;
+	const uint8_t* stop = s + (len & ~((size_t) 31));
+	__m256i prev = _mm256_setzero_si256();
+	__m256i prevIncomplete = _mm256_setzero_si256();
+	for (; p < stop; p += 32) {
+		__m256i in = _mm256_loadu_si256((const __m256i*) (const void*) p);
+		__m256i err;
+		if (_mm256_movemask_epi8(in) == 0) {
+			// ascii: only an incomplete character at the end of the previous block is an error
+			err = prevIncomplete;
+			prevIncomplete = _mm256_setzero_si256();
+		} else {
+			__m256i prev1 = OPAUTF8_PREV(in, prev, 1);
+			__m256i sc = _mm256_and_si256(_mm256_and_si256(
+				_mm256_shuffle_epi8(byte1High, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+				_mm256_shuffle_epi8(byte1Low, _mm256_and_si256(prev1, nibble))),
+				_mm256_shuffle_epi8(byte2High, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+			__m256i third = _mm256_subs_epu8(OPAUTF8_PREV(in, prev, 2), _mm256_set1_epi8(C(0xE0 - 0x80)));
+			__m256i fourth = _mm256_subs_epu8(OPAUTF8_PREV(in, prev, 3), _mm256_set1_epi8(C(0xF0 - 0x80)));
+			__m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(C(0x80)));
+			err = _mm256_xor_si256(must23, sc);
+			prevIncomplete = _mm256_subs_epu8(in, maxLast);
+		}
+		if (!_mm256_testz_si256(err, err)) {
+			break;
+		}
+		prev = in;
+	}
+	return opautf8Boundary(s, p);
+}
+
+#elif defined(OPAUTF8_SSSE3)
+
+size_t opautf8ValidPrefix(const uint8_t* s, size_t len) {
+	const __m128i byte1High = _mm_setr_epi8(OPAUTF8_BYTE1HIGH);
+	const __m128i byte1Low = _mm_setr_epi8(OPAUTF8_BYTE1LOW);
+	const __m128i byte2High = _mm_setr_epi8(OPAUTF8_BYTE2HIGH);
+	const __m128i maxLast = _mm_setr_epi8(OPAUTF8_FF4, OPAUTF8_FF4, OPAUTF8_FF4, C(0xFF), OPAUTF8_MAXLAST3);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i zero = _mm_setzero_si128();
+	const uint8_t* p = s;
+	const uint8_t* stop = s + (len & ~((size_t) 15));
+	__m128i prev = zero;
+	__m128i prevIncomplete = zero;
+	for (; p < stop; p += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i*) (const void*) p);
+		__m128i err;
+		if (_mm_movemask_epi8(in) == 0) {
+			// ascii: only an incomplete character at the end of the previous block is an error
+			err = prevIncomplete;
+			prevIncomplete = zero;
+		} else {
+			__m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+			__m128i sc = _mm_and_si128(_mm_and_si128(
+				_mm_shuffle_epi8(byte1High, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+				_mm_shuffle_epi8(byte1Low, _mm_and_si128(prev1, nibble))),
+				_mm_shuffle_epi8(byte2High, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+			__m128i third = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), _mm_set1_epi8(C(0xE0 - 0x80)));
+			__m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), _mm_set1_epi8(C(0xF0 - 0x80)));
+			__m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(C(0x80)));
+			err = _mm_xor_si128(must23, sc);
+			prevIncomplete = _mm_subs_epu8(in, maxLast);
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(err, zero)) != 0xFFFF) {
+			break;
+		}
+		prev = in;
+	}
+	return opautf8Boundary(s, p);
+}
+
+#elif defined(__SSE2__)
+
+size_t opautf8ValidPrefix(const uint8_t* s, size_t len) {
+	// skip in chunks of 16 bytes if MSB is not set (chars are ASCII)
+	const uint8_t* p = s;
+	const uint8_t* stop = s + (len & ~((size_t) 15));
+	for (; p < stop; p += 16) {
+		int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (const void*) p));
+		if (mask != 0) {
+			// this chunk contains a non-ascii character
+			return p - s + __builtin_ctz(mask);
+		}
+	}
+	return opautf8Boundary(s, p);
+}
+
+#else
+
+size_t opautf8ValidPrefix(const uint8_t* s, size_t len) {
+	// skip ASCII characters 8 at a time
+	const uint8_t* p = s;
+	const uint8_t* stop = s + (len & ~((size_t) 7));
+	for (; p < stop; p += 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		if (v & 0x8080808080808080ULL) {
+			break;
+		}
+	}
+	return opautf8Boundary(s, p);
+}
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2018-2019 Opatomic
+ * Open sourced with ISC license. Refer to LICENSE for details.
+ */
+
+#ifndef OPAUTF8_H_
+#define OPAUTF8_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Find the length of the longest prefix of s that is known to be valid UTF-8 and that ends on a character
+ * boundary. Only whole blocks of 32 (AVX2), 16 (SSSE3/SSE2) or 8 bytes are checked so the result can be
+ * shorter than the valid prefix; the caller must check the remaining bytes (and report the exact position
+ * of an error) with a scalar validator that starts at the returned offset. The implementation is chosen at
+ * compile time: AVX2 or SSSE3 validate every block (Keiser/Lemire lookup algorithm); SSE2 and the portable
+ * version only skip ASCII characters.
+ * @param s Bytes to check. Must start on a character boundary
+ * @param len Number of bytes
+ * @return number of bytes at the start of s that are valid UTF-8
+ */
+size_t opautf8ValidPrefix(const uint8_t* s, size_t len);
+
+#endif